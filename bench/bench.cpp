@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#include <uv.h>
+#include <Logger.hpp>
+#include <Client.hpp>
+
+/**
+ * Allocation counting: every operator new in the process, including the
+ * ones made inside libmdnscpp, goes through here.
+ */
+static size_t allocations = 0;
+
+void* operator new (size_t size)
+{
+    allocations++;
+    void* p = malloc (size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete (void* p) noexcept
+{
+    free (p);
+}
+
+void operator delete (void* p, size_t) noexcept
+{
+    free (p);
+}
+
+namespace MDns {
+
+class Bench {
+
+public:
+
+    Bench (const std::string& filter) : _filter (filter) {
+
+        Logger::setLogLevel (Logger::NONE);
+
+        _mdns = Client::New (uv_default_loop());
+
+        memset (&_sender, 0, sizeof(_sender));
+        uv_ip4_addr ("192.0.2.1", 5353, &_sender);
+
+        //NOTE: datagrams are fed as if received on the first interface,
+        // without one the receive path can not be measured
+        if (!_mdns->_udpHandleToInterface.empty()) {
+            _handle = _mdns->_udpHandleToInterface.begin()->first;
+        }
+
+        _callback = std::make_shared<Client::CallbackA> ([&](bool error, const std::string& name, const std::string& ipAddress) {
+            _answered++;
+        });
+    }
+
+    ~Bench () {
+        _mdns = nullptr;
+        uv_run (uv_default_loop(), UV_RUN_NOWAIT);
+    }
+
+    void start () {
+
+        printf ("%-36s %12s %12s\n", "benchmark", "ns/op", "allocs/op");
+
+        benchParse();
+        benchEncode();
+        benchNames();
+
+        if (_handle == nullptr) {
+            printf ("no multicast interface, cache/ receive/ and notify/ skipped\n");
+            return;
+        }
+        benchCache();
+        benchNotify();
+    }
+
+private:
+
+    std::string                        _filter;
+    std::shared_ptr<Client>            _mdns;
+    std::shared_ptr<Client::CallbackA> _callback;
+    uv_udp_t*                          _handle = nullptr;
+    struct sockaddr_in                 _sender;
+    size_t                             _answered = 0;
+
+    template <typename F>
+    void run (
+        const char* name,
+        size_t iterations,
+        F f)
+    {
+        if (!_filter.empty() && std::string (name).find (_filter) == std::string::npos) {
+            return;
+        }
+
+        // Warm up, lets reusable buffers reach their working size
+        for (size_t i = 0; i < iterations / 10 + 1; i++) {
+            f (i);
+        }
+
+        size_t allocationsBefore = allocations;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            f (i);
+        }
+        auto end = std::chrono::steady_clock::now();
+        size_t allocationsAfter = allocations;
+
+        double ns = std::chrono::duration<double, std::nano>(end - start).count();
+        printf ("%-36s %12.1f %12.2f\n",
+                name,
+                ns / iterations,
+                (double)(allocationsAfter - allocationsBefore) / iterations);
+    }
+
+    /**
+     * Realistic packets
+     */
+
+    static void putName (
+        std::vector<uint8_t>& rdata,
+        const std::string& name)
+    {
+        size_t start = 0;
+        while (start < name.size()) {
+            size_t end = name.find ('.', start);
+            if (end == std::string::npos) {
+                end = name.size();
+            }
+            rdata.push_back ((uint8_t)(end - start));
+            rdata.insert (rdata.end(), name.begin() + start, name.begin() + end);
+            start = end + 1;
+        }
+        rdata.push_back (0);
+    }
+
+    static std::shared_ptr<std::vector<uint8_t>> responseA () {
+        struct sockaddr_in addr;
+        uv_ip4_addr ("192.0.2.10", 0, &addr);
+        return DnsPacket::NewResponseA ("0b7e6a3c-2f1d-4e55-9d1b-4a2f3c5d6e7f.local", 120, &addr);
+    }
+
+    //NOTE: PTR + SRV + TXT + A + AAAA, as sent by a DNS-SD responder
+    static std::shared_ptr<std::vector<uint8_t>> responseDnsSd () {
+
+        DnsPacket::Encoder encoder (0x8400U);
+        std::vector<uint8_t> rdata;
+
+        putName (rdata, "Living Room._airplay._tcp.local");
+        encoder.addRecord (DnsPacket::ENTRYTYPE_ANSWER, "_airplay._tcp.local",
+                           DnsPacket::RECORDTYPE_PTR, false, 4500, rdata.data(), rdata.size());
+
+        rdata = { 0, 0, 0, 0, 0x1b, 0x58 }; // priority, weight, port 7000
+        putName (rdata, "living-room.local");
+        encoder.addRecord (DnsPacket::ENTRYTYPE_ADDITIONAL, "Living Room._airplay._tcp.local",
+                           DnsPacket::RECORDTYPE_SRV, true, 120, rdata.data(), rdata.size());
+
+        rdata.clear();
+        for (auto txt: { "deviceid=58:55:CA:1A:E2:88", "features=0x5A7FFFF7,0x1E", "model=AppleTV6,2", "srcvers=550.10" }) {
+            rdata.push_back ((uint8_t)strlen (txt));
+            rdata.insert (rdata.end(), txt, txt + strlen (txt));
+        }
+        encoder.addRecord (DnsPacket::ENTRYTYPE_ADDITIONAL, "Living Room._airplay._tcp.local",
+                           DnsPacket::RECORDTYPE_TXT, true, 4500, rdata.data(), rdata.size());
+
+        struct sockaddr_in addr;
+        uv_ip4_addr ("192.0.2.20", 0, &addr);
+        encoder.addRecordA (DnsPacket::ENTRYTYPE_ADDITIONAL, "living-room.local", 120, &addr);
+
+        struct sockaddr_in6 addr6;
+        uv_ip6_addr ("fe80::1c2b:3a4d:5e6f:7081", 0, &addr6);
+        encoder.addRecordAAAA (DnsPacket::ENTRYTYPE_ADDITIONAL, "living-room.local", 120, &addr6);
+
+        return encoder.getPacket();
+    }
+
+    //NOTE: 20 PTR records sharing the _tcp.local suffix
+    static std::shared_ptr<std::vector<uint8_t>> responseCompressed () {
+
+        DnsPacket::Encoder encoder (0x8400U);
+        std::vector<uint8_t> rdata;
+
+        for (int i = 0; i < 20; i++) {
+            rdata.clear();
+            putName (rdata, "printer-" + std::to_string (i) + "._ipp._tcp.local");
+            encoder.addRecord (DnsPacket::ENTRYTYPE_ANSWER, "service-" + std::to_string (i) + "._tcp.local",
+                               DnsPacket::RECORDTYPE_PTR, false, 4500, rdata.data(), rdata.size());
+        }
+        return encoder.getPacket();
+    }
+
+    /**
+     * Benchmarks
+     */
+
+    void benchParse () {
+
+        DnsPacket::Packet packet;
+
+        auto a = responseA();
+        run ("parse/response-a", 1000000, [&](size_t) {
+            DnsPacket::Parse (a->data(), a->size(), packet);
+        });
+
+        auto dnssd = responseDnsSd();
+        run ("parse/dns-sd-ptr-srv-txt-a-aaaa", 1000000, [&](size_t) {
+            DnsPacket::Parse (dnssd->data(), dnssd->size(), packet);
+        });
+
+        auto compressed = responseCompressed();
+        run ("parse/20-ptr-compressed", 500000, [&](size_t) {
+            DnsPacket::Parse (compressed->data(), compressed->size(), packet);
+        });
+
+        std::string name;
+        run ("parse+decode/20-ptr-compressed", 200000, [&](size_t) {
+            DnsPacket::Parse (compressed->data(), compressed->size(), packet);
+            for (auto& record: packet.records) {
+                packet.decodeName (record.name.offset, name);
+            }
+        });
+
+        run ("scan/dns-sd-ptr-srv-txt-a-aaaa", 1000000, [&](size_t) {
+            DnsPacket::Scanner scanner (dnssd->data(), dnssd->size());
+            while (scanner.next()) {
+            }
+        });
+    }
+
+    void benchEncode () {
+
+        run ("encode/NewQueryA", 1000000, [&](size_t) {
+            DnsPacket::NewQueryA ("0b7e6a3c-2f1d-4e55-9d1b-4a2f3c5d6e7f.local");
+        });
+
+        struct sockaddr_in addr;
+        uv_ip4_addr ("192.0.2.10", 0, &addr);
+        run ("encode/NewResponseA", 1000000, [&](size_t) {
+            DnsPacket::NewResponseA ("0b7e6a3c-2f1d-4e55-9d1b-4a2f3c5d6e7f.local", 120, &addr);
+        });
+
+        std::vector<std::string> names;
+        for (int i = 0; i < 20; i++) {
+            names.push_back ("peer-" + std::to_string (i) + ".local");
+        }
+        run ("encode/query-20-questions", 200000, [&](size_t) {
+            DnsPacket::Encoder encoder (0x0000U);
+            for (auto& name: names) {
+                encoder.addQuestion (name, DnsPacket::RECORDTYPE_A);
+            }
+        });
+    }
+
+    void benchNames () {
+
+        auto a = responseA();
+        const std::string name = "0B7E6A3C-2F1D-4E55-9D1B-4A2F3C5D6E7F.local";
+        DnsPacket::Packet packet;
+        DnsPacket::Parse (a->data(), a->size(), packet);
+
+        run ("name/equals-ignore-case", 2000000, [&](size_t) {
+            packet.records[0].name.equals (name);
+        });
+
+        run ("name/hash-wire", 2000000, [&](size_t) {
+            DnsPacket::HashName (a->data(), a->size(), 12);
+        });
+
+        run ("name/hash-string", 2000000, [&](size_t) {
+            DnsPacket::HashName (name);
+        });
+    }
+
+    void feed (
+        const std::shared_ptr<std::vector<uint8_t>>& datagram)
+    {
+        uv_buf_t buf;
+        buf.base = (char*) datagram->data();
+        buf.len  = datagram->size();
+        _mdns->handleUdpDatagram (_handle,
+                                  datagram->size(),
+                                  &buf,
+                                  (const struct sockaddr*)&_sender,
+                                  0);
+    }
+
+    void benchCache () {
+
+        const size_t numPeers = 1000;
+        std::vector<std::string> names;
+        std::vector<std::shared_ptr<std::vector<uint8_t>>> responses;
+        struct sockaddr_in addr;
+        uv_ip4_addr ("192.0.2.30", 0, &addr);
+        for (size_t i = 0; i < numPeers; i++) {
+            names.push_back ("cached-peer-" + std::to_string (i) + ".local");
+            responses.push_back (DnsPacket::NewResponseA (names.back(), 120, &addr));
+        }
+
+        run ("cache/insert-refresh-1000-peers", 200000, [&](size_t i) {
+            feed (responses[i % numPeers]);
+        });
+
+        run ("cache/lookup-hit-1000-peers", 1000000, [&](size_t i) {
+            _mdns->queryA (names[i % numPeers], _callback, 500);
+        });
+
+        RecordCache::address_t address;
+        run ("cache/try-lookup-hit-1000-peers", 1000000, [&](size_t i) {
+            _mdns->tryLookup (names[i % numPeers], DnsPacket::RECORDTYPE_A, address);
+        });
+
+        auto unrelated = responseDnsSd();
+        _mdns->setCacheUnsolicited (false);
+        run ("receive/reject-unrelated", 1000000, [&](size_t) {
+            feed (unrelated);
+        });
+        _mdns->setCacheUnsolicited (true);
+    }
+
+    void benchNotify () {
+
+        const size_t numPeers = 100;
+        std::vector<std::string> names;
+        std::vector<std::shared_ptr<std::vector<uint8_t>>> responses;
+        struct sockaddr_in addr;
+        uv_ip4_addr ("192.0.2.40", 0, &addr);
+        for (size_t i = 0; i < numPeers; i++) {
+            names.push_back ("pending-peer-" + std::to_string (i) + ".local");
+            responses.push_back (DnsPacket::NewResponseA (names.back(), 0, &addr));
+        }
+
+        //NOTE: query a name missing from the cache then deliver its answer,
+        // a TTL of 0 keeps the name out of the cache for the next round
+        run ("notify/query-then-answer", 50000, [&](size_t i) {
+            _mdns->queryA (names[i % numPeers], _callback, 500);
+            auto& response = responses[i % numPeers];
+            // TTL 120, patched so the record is cached and dispatched
+            (*response)[response->size() - 7] = 120;
+            feed (response);
+            // TTL 0, removes it again
+            (*response)[response->size() - 7] = 0;
+            feed (response);
+            if (i % 1000 == 0) {
+                uv_run (uv_default_loop(), UV_RUN_NOWAIT);
+            }
+        });
+    }
+
+};
+
+}
+
+int main (int argc, char* argv[]) {
+
+    auto bench = new MDns::Bench (argc > 1 ? argv[1] : "");
+    bench->start();
+    delete bench;
+    return 0;
+}
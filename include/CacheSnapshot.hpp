@@ -0,0 +1,106 @@
+#ifndef __MDNS_CACHESNAPSHOT_HPP__
+#define __MDNS_CACHESNAPSHOT_HPP__
+
+#include <memory>
+#include <string>
+#include "Logger.hpp"
+#include "DnsPacket.hpp"
+#include "RecordCache.hpp"
+
+namespace MDns {
+
+/**
+ * On-disk copy of the record cache, so a restarted process can answer
+ * from it right away.
+ *
+ * The file is mapped with mmap and holds one fixed-size slot per cache
+ * entry, slot i mirrors entry i of the RecordCache slab. Every insert,
+ * refresh or removal rewrites only its slot in the mapping, the kernel
+ * writes it back. Expiry times are absolute (msecs since the epoch), so
+ * they stay valid across restarts. The file is in host byte order and
+ * meant for the machine that wrote it.
+ */
+class CacheSnapshot {
+
+public:
+
+    typedef struct {
+        std::string          name;
+        uint16_t             type;
+        uint32_t             ttl;
+        uint64_t             remaining; // msecs
+        RecordCache::address_t address;
+    } record_t;
+
+    /**
+     * Maps path, creating it when missing or not a snapshot. Returns
+     * nullptr on error.
+     */
+    static std::unique_ptr<CacheSnapshot> Open (
+        const std::string& path);
+
+    ~CacheSnapshot ();
+
+    /**
+     * Records that have not expired yet.
+     */
+    std::vector<record_t> load () const;
+
+    void clear ();
+
+    void store (
+        uint32_t index,
+        const RecordCache::entry_t& entry,
+        const std::string& name,
+        uint64_t now);
+
+    void remove (
+        uint32_t index);
+
+private:
+
+    static const uint32_t MAGIC = 0x4d444e43U; // "MDNC"
+    static const uint32_t VERSION = 1;
+    static const uint32_t INITIAL_SLOTS = 64;
+    static std::shared_ptr<Logger> LOG;
+
+    typedef struct {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slots;
+        uint32_t reserved;
+    } header_t;
+
+    typedef struct {
+        uint8_t  used;
+        uint8_t  nameLength;
+        uint16_t type;
+        uint32_t ttl;
+        uint64_t expiration; // msecs since the epoch
+        uint8_t  address[16];
+        char     name[DnsPacket::MAX_NAME_LENGTH + 1];
+    } slot_t;
+
+    int       _fd = -1;
+    uint8_t*  _data = nullptr;
+    size_t    _size = 0;
+
+    CacheSnapshot () {}
+
+    header_t* header () const { return (header_t*) _data; }
+
+    slot_t* slot (
+        uint32_t index) const
+    {
+        return (slot_t*) (_data + sizeof(header_t)) + index;
+    }
+
+    bool map (
+        uint32_t slots);
+
+    static uint64_t WallClock ();
+};
+
+}
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef __MDNS_CACHEVIEW_HPP__
+#define __MDNS_CACHEVIEW_HPP__
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "Logger.hpp"
+#include "DnsPacket.hpp"
+#include "RecordCache.hpp"
+
+namespace MDns {
+
+/**
+ * Read-only copy of the record cache that any thread can query without
+ * locks.
+ *
+ * The loop thread, the only writer, builds a new immutable table and
+ * swaps it in with publish(). Readers register in one of two counters,
+ * chosen by the parity of an epoch that publish() advances. A replaced
+ * table is freed once the counter of its epoch drains, and no table is
+ * published until then, so a reader never sees freed memory.
+ */
+class CacheView {
+
+public:
+
+    typedef struct {
+        std::string            name;
+        uint16_t               type;
+        RecordCache::address_t address;
+        uint64_t               expiration; // msecs, see Now()
+    } record_t;
+
+    CacheView ();
+
+    ~CacheView ();
+
+    /**
+     * Loop thread only. Returns false when readers still hold the table
+     * replaced by the previous publish, try again later.
+     */
+    bool publish (
+        const RecordCache& cache,
+        uint64_t now);
+
+    /**
+     * Any thread. Unexpired address of (name, type) with the latest
+     * expiration.
+     */
+    bool lookup (
+        const std::string& name,
+        uint16_t type,
+        RecordCache::address_t& address) const;
+
+    /**
+     * Any thread. Copy of every record in the table.
+     */
+    std::vector<record_t> records () const;
+
+    //NOTE: msecs from uv_hrtime, readable from any thread
+    static uint64_t Now ();
+
+    static std::string AddressToString (
+        const record_t& record);
+
+private:
+
+    static const size_t MIN_SLOTS = 16;
+    static std::shared_ptr<Logger> LOG;
+
+    typedef struct {
+        std::vector<record_t> records;
+        std::vector<uint64_t> hashes;
+        std::vector<uint32_t> slots; // record index + 1, 0 is empty
+    } table_t;
+
+    std::atomic<table_t*>          _current;
+    std::atomic<uint64_t>          _epoch;
+    mutable std::atomic<uint32_t>  _readers[2];
+
+    //NOTE: replaced table waiting for the readers of its epoch parity
+    table_t* _retired = nullptr;
+    uint32_t _retiredParity = 0;
+
+    bool reclaim ();
+
+    template <typename F>
+    void read (
+        F f) const
+    {
+        while (true) {
+            uint64_t epoch = _epoch.load();
+            _readers[epoch & 1].fetch_add (1);
+            //NOTE: if the epoch moved on, the writer may have found this
+            // counter empty already, register again under the new one
+            if (_epoch.load() == epoch) {
+                f (_current.load());
+                _readers[epoch & 1].fetch_sub (1);
+                return;
+            }
+            _readers[epoch & 1].fetch_sub (1);
+        }
+    }
+};
+
+}
+
+#endif
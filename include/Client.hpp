@@ -4,11 +4,17 @@
 #include <functional>
 #include <list>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <time.h>
 #include <uv.h>
 #include "Logger.hpp"
 #include "DnsPacket.hpp"
+#include "NameTable.hpp"
+#include "RecordCache.hpp"
+#include "CacheSnapshot.hpp"
+#include "CacheView.hpp"
 
 namespace MDns {
 
@@ -29,9 +35,34 @@ public:
         const std::string& ipAddress
     )> CallbackA;
   
+    /**
+     * A cached A/AAAA record is gone, its TTL ran out or its owner sent
+     * a goodbye (TTL 0).
+     */
+    typedef std::function<void(
+        const std::string& name, 
+        const std::string& ipAddress
+    )> CallbackExpired;
+  
+    /**
+     * An instance of a browsed service type appeared (added) or went
+     * away, e.g. "My Printer._ipp._tcp.local" for "_ipp._tcp.local".
+     */
+    typedef std::function<void(
+        bool added,
+        const std::string& serviceType,
+        const std::string& instance
+    )> CallbackBrowse;
+  
+    /**
+     * snapshotPath, when not empty, is a file the record cache is
+     * mirrored to. Records still valid in it are loaded here, so they
+     * are answered from the cache right after a restart.
+     */
     static std::shared_ptr<Client> New (
         uv_loop_t* loop, 
-        NetworkInterfaceFilter filter = NET_IFACES_DEFAULT);
+        NetworkInterfaceFilter filter = NET_IFACES_DEFAULT,
+        const std::string& snapshotPath = "");
     
     ~Client (); 
     
@@ -48,9 +79,116 @@ public:
         std::shared_ptr<CallbackA> callback, 
         uint32_t timeoutMsecs);
     
+    void queryAAAA (
+        const std::string& name, 
+        std::shared_ptr<CallbackA> callback, 
+        uint32_t timeoutMsecs);
+    
+    /**
+     * Dual-stack lookup, A and AAAA are asked in the same packet. An
+     * IPv6 address is returned as soon as it is known, an IPv4 one after
+     * waiting RESOLUTION_DELAY msecs for IPv6 (happy eyeballs, RFC 8305
+     * 3). Fails when both families fail.
+     */
+    void resolve (
+        const std::string& name, 
+        std::shared_ptr<CallbackA> callback, 
+        uint32_t timeoutMsecs);
+    
+    /**
+     * Continuous DNS-SD browse of serviceType (RFC 6763 4.1). The
+     * instances already known are reported at once, then every change
+     * as a delta. The PTR set is kept current from overheard responses
+     * and from queries sent at doubling intervals up to
+     * BROWSE_MAX_INTERVAL, and when an instance reaches 80% of its TTL
+     * (RFC 6762 5.2). callback is held weakly, the browse stops once no
+     * callback is left or on stopBrowse.
+     */
+    void browse (
+        const std::string& serviceType,
+        std::shared_ptr<CallbackBrowse> callback);
+    
+    void stopBrowse (
+        const std::string& serviceType);
+    
+    /**
+     * Cached address of name copied to address, in network byte order
+     * (v4 for A, v6 for AAAA). Loop thread only. Does not allocate nor
+     * query, false when nothing valid is cached.
+     */
+    bool tryLookup (
+        const std::string& name,
+        DnsPacket::record_type_t type,
+        RecordCache::address_t& address);
+    
+    /**
+     * callback is held weakly, the caller keeps it alive.
+     */
+    void setExpiryCallback (
+        std::shared_ptr<CallbackExpired> callback);
+    
+    /**
+     * Least recently used records are evicted beyond maxEntries, 0 is
+     * unlimited.
+     */
+    void setCacheMaxEntries (
+        size_t maxEntries);
+    
+    /**
+     * false caches only names that were queried, records overheard for
+     * any other name are dropped.
+     */
+    void setCacheUnsolicited (
+        bool cacheUnsolicited);
+    
+    /**
+     * A query that times out makes its name fail at once for msecs
+     * afterwards, unless a record for it shows up. 0, the default,
+     * disables it. NSEC records deny names regardless, for their TTL.
+     */
+    void setNegativeHoldDown (
+        uint32_t msecs);
+    
+    RecordCache::stats_t getCacheStats () const;
+    
+    /**
+     * Cached address of name, can be called from any thread. Reads a
+     * copy of the cache published by the loop thread, which can be up
+     * to VIEW_PUBLISH_DELAY msecs behind.
+     */
+    bool lookupCached (
+        const std::string& name,
+        DnsPacket::record_type_t type,
+        std::string& ipAddress) const;
+    
+    /**
+     * Every cached record, can be called from any thread, see
+     * lookupCached.
+     */
+    std::vector<CacheView::record_t> getCachedRecords () const;
+    
+    /**
+     * Questions issued within this window are sent together, packed in
+     * as few datagrams as the MTU allows. 0 sends every query at once.
+     */
+    void setQueryCoalescingWindow (
+        uint32_t msecs);
+    
+    /**
+     * A query still unanswered msecs after it was sent is sent again,
+     * with its known answers, and then again at doubling intervals
+     * until its timeout (RFC 6762 5.2). 0 sends every query once.
+     */
+    void setQueryRetransmitInterval (
+        uint32_t msecs);
+    
 private:
 
     friend class NhLookup;
+#ifdef MDNSCPP_BENCH
+    //NOTE: only the benchmark target defines it, to feed datagrams
+    friend class Bench;
+#endif
     
     typedef struct {
         std::string name;
@@ -58,41 +196,169 @@ private:
         std::string ipAddress;
     } networkInterface_t;
     
+    //NOTE: one in-flight query per (name, type), shared by every caller
+    // asking for it meanwhile
     typedef struct {
-        Client* mdns;
-        std::weak_ptr<CallbackA> callbackWeak;
-        std::unique_ptr<uv_timer_t> uvTimerHandler = std::make_unique<uv_timer_t>();
-        std::string name;
-        uint32_t timeoutMsecs;
+        std::list<std::weak_ptr<CallbackA>> callbacks;
+        NameTable::id_t name;
+        uint16_t type;
+        uint64_t deadline;   // msecs, loop time
+        uint64_t retransmit; // msecs, loop time, 0 none
+        uint32_t interval;   // msecs to the retransmission after it
     } queryHandler_t;
     
     static const int32_t DEFAULT_TTL = 120;
+    static const uint32_t DEFAULT_QUERY_COALESCING_WINDOW = 10;
+    static const uint32_t DEFAULT_QUERY_RETRANSMIT_INTERVAL = 1000;
+    static const uint32_t RESOLUTION_DELAY = 50;
+    static const size_t DEFAULT_CACHE_MAX_ENTRIES = 4096;
+    //NOTE: opt-in, a retry after a timeout goes to the network
+    static const uint32_t DEFAULT_NEGATIVE_HOLD_DOWN = 0;
+    static const uint32_t VIEW_PUBLISH_DELAY = 20;
+    //NOTE: 1500 bytes Ethernet MTU minus IPv6 and UDP headers
+    static const size_t QUERY_PACKET_SIZE = 1452;
     static std::shared_ptr<Logger> LOG;
 
-    //NOTE: recordName -> list of query Handlers 
-    typedef std::map<
-        std::string, 
-        std::list<std::shared_ptr<queryHandler_t>>
+    //NOTE: in-flight resolve() of a name, driven by an A and an AAAA query
+    typedef struct {
+        std::list<std::weak_ptr<CallbackA>> callbacks;
+        NameTable::id_t name;
+        std::shared_ptr<CallbackA> callbackA;
+        std::shared_ptr<CallbackA> callbackAAAA;
+        std::string addressA;        // held while waiting for AAAA
+        uint64_t    delayUntil = 0;  // msecs, loop time
+        bool        failedA = false;
+        bool        failedAAAA = false;
+    } resolve_t;
+    
+    //NOTE: an instance found by a browse
+    typedef struct {
+        uint32_t ttl;        // secs
+        uint64_t received;   // msecs, loop time
+        uint64_t expiration; // msecs, loop time
+        uint64_t refresh;    // msecs, loop time, next refresh point, 0 none
+        uint8_t  refreshes;  // refresh points passed since received
+    } browseInstance_t;
+    
+    //NOTE: continuous browse of a service type
+    typedef struct {
+        std::list<std::weak_ptr<CallbackBrowse>> callbacks;
+        NameTable::id_t name;
+        //NOTE: instance name id -> instance, holds a reference to the name
+        std::unordered_map<NameTable::id_t, browseInstance_t> instances;
+        uint64_t nextQuery; // msecs, loop time
+        uint32_t interval;  // msecs to the query after it
+        uint64_t due;       // msecs, loop time, of its event in the heap
+    } browse_t;
+    
+    static const uint32_t BROWSE_FIRST_INTERVAL = 1000;
+    static const uint32_t BROWSE_MAX_INTERVAL = 3600000;
+    //NOTE: RFC 6762 10.1, a goodbye removes a record one second later
+    static const uint32_t GOODBYE_DELAY = 1000;
+    
+    //NOTE: event type of the end of a resolve() delay for IPv6
+    static const uint16_t RESOLUTION_DELAY_EVENT = DnsPacket::RECORDTYPE_IGNORE;
+    
+    //NOTE: a deadline or a retransmission of the query for (name, type)
+    typedef struct {
+        uint64_t        when; // msecs, loop time
+        NameTable::id_t name;
+        uint16_t        type;
+    } queryEvent_t;
+    
+    //NOTE: orders a std heap by earliest event
+    struct QueryEventLater {
+        bool operator() (
+            const queryEvent_t& a,
+            const queryEvent_t& b) const
+        {
+            return a.when > b.when;
+        }
+    };
+    
+    //NOTE: record name id -> in-flight query
+    typedef std::unordered_map<
+        NameTable::id_t, 
+        std::shared_ptr<queryHandler_t>
     > recordCallbacks_t;
     
     uv_loop_t* _loop = nullptr;
     
+    //NOTE: reused for every received datagram, see libuvAllocCallback
+    std::vector<uint8_t> _recvBuffer = std::vector<uint8_t>(65536);
+    DnsPacket::Packet    _recvPacket;
+    
     std::string _uuid;
     std::map<uv_udp_t*, networkInterface_t> _udpHandleToInterface;
     std::map<std::string, uv_udp_t*>        _ifaceToUdpHandleIpv4;
     std::map<std::string, uv_udp_t*>        _ifaceToUdpHandleIpv6;
+    
+    //NOTE: ff02::fb and 224.0.0.251 port 5353
+    struct sockaddr_in  _mdnsGroupIpv4;
+    struct sockaddr_in6 _mdnsGroupIpv6;
+    
+    typedef struct {
+        std::shared_ptr<std::vector<uint8_t>> packet;
+        size_t ttlOffset;
+    } responseTemplate_t;
+    
+    //NOTE: udp handle -> encoded response with our record for the
+    // interface of that handle, see buildResponseTemplates
+    std::map<uv_udp_t*, responseTemplate_t> _responseTemplatesA;
+    std::map<uv_udp_t*, responseTemplate_t> _responseTemplatesAAAA;
 
-    //NOTE: value is <expiration(ttl), IPv4>
-    std::map<std::string, std::pair<time_t, std::string>> _recordsA; 
+    //NOTE: names of cached records and pending queries, the cache holds
+    // a reference so it is declared first
+    NameTable   _names;
+    //NOTE: A and AAAA records
+    RecordCache _cache;
+    std::unique_ptr<CacheSnapshot> _snapshot;
     recordCallbacks_t _recordsACallbacks;
-    
-    //NOTE: value is <expiration(ttl), IPv6>
-    std::map<std::string, std::pair<time_t, std::string>> _recordsAAAA; 
     recordCallbacks_t _recordsAAAACallbacks;
+    //NOTE: name id -> in-flight resolve
+    std::unordered_map<NameTable::id_t, std::shared_ptr<resolve_t>> _resolves;
+    //NOTE: service type id -> browse, its events in the query heap are
+    // of type PTR
+    std::unordered_map<NameTable::id_t, std::shared_ptr<browse_t>> _browses;
+    
+    //NOTE: fires when the earliest cache entry expires, see libuvExpireRecords
+    uv_timer_t* _expiryTimer = nullptr;
+    uint64_t    _expiryTimerDue = 0;
+    std::weak_ptr<CallbackExpired> _expiryCallbackWeak;
+    
+    //NOTE: copy of the cache for other threads. Changes are published
+    // in batches, VIEW_PUBLISH_DELAY after the first one
+    CacheView   _view;
+    uv_check_t* _publishCheck = nullptr;
+    uv_timer_t* _publishTimer = nullptr;
+    uint64_t    _publishedVersion = 0;
+    
+    //NOTE: hashes of cached and queried names, used by acceptDatagram.
+    // Stale hashes only let a few more packets through, so the set is
+    // rebuilt lazily when it grows well beyond the names it mirrors.
+    std::unordered_set<uint64_t> _watchedNames;
+    //NOTE: cache every A/AAAA record overheard, not only queried names
+    bool _cacheUnsolicited = true;
+    uint32_t _negativeHoldDown = DEFAULT_NEGATIVE_HOLD_DOWN;
+    
+    //NOTE: questions waiting for the coalescing window, <name, type>
+    std::vector<std::pair<std::string, uint16_t>> _pendingQuestions;
+    uv_timer_t* _flushQuestionsTimer = nullptr;
+    uint32_t    _queryCoalescingWindow = DEFAULT_QUERY_COALESCING_WINDOW;
+    uint32_t    _queryRetransmitInterval = DEFAULT_QUERY_RETRANSMIT_INTERVAL;
+    
+    //NOTE: min-heap of the in-flight query deadlines and retransmissions,
+    // one timer for all of them. Entries are not removed when a query is
+    // answered, they are dropped when reached if their query is gone or
+    // no longer has an event at that time
+    std::vector<queryEvent_t> _queryEvents;
+    uv_timer_t* _queryTimer = nullptr;
+    uint64_t    _queryTimerDue = 0;
        
     Client (
         uv_loop_t* loop, 
-        NetworkInterfaceFilter filter);
+        NetworkInterfaceFilter filter,
+        const std::string& snapshotPath);
     
     static void libuvAllocCallback (
         uv_handle_t* handle, 
@@ -105,8 +371,20 @@ private:
         const struct sockaddr* addr, 
         unsigned flags);
     
-    static void libuvTimeoutHandlerForQueries (
+    static void libuvQueryEvents (
         uv_timer_t* handle);    
+    
+    static void libuvFlushQuestions (
+        uv_timer_t* handle);
+    
+    static void libuvExpireRecords (
+        uv_timer_t* handle);
+    
+    static void libuvCheckPublish (
+        uv_check_t* handle);
+    
+    static void libuvPublishView (
+        uv_timer_t* handle);
         
     std::shared_ptr<std::list<networkInterface_t>> getNetworkInterfaces (
         NetworkInterfaceFilter filter);
@@ -118,6 +396,42 @@ private:
         const struct sockaddr* addr,
         unsigned flags);
     
+    bool acceptDatagram (
+        const uint8_t* data,
+        size_t size);
+    
+    void watchName (
+        uint64_t hash);
+    
+    void cacheRecord (
+        const DnsPacket::Packet& packet,
+        const DnsPacket::Record& record);
+    
+    void cacheNsec (
+        const DnsPacket::Packet& packet,
+        const DnsPacket::Record& record);
+    
+    void browseRecord (
+        const DnsPacket::Packet& packet,
+        const DnsPacket::Record& record);
+    
+    void scheduleBrowse (
+        browse_t& browse,
+        uint64_t when);
+    
+    void runBrowse (
+        std::shared_ptr<browse_t> browse,
+        uint64_t now);
+    
+    bool isBrowsing (
+        const browse_t& browse) const;
+    
+    void notifyBrowse (
+        browse_t& browse,
+        bool added,
+        const std::string& serviceType,
+        const std::string& instance);
+    
     uv_udp_t* socketOpenIpv4 (
         const std::string& ifname);
     
@@ -125,14 +439,80 @@ private:
         const std::string& ifname);
     
     void notify (
-        DnsPacket::record_type_t type, 
-        const std::string& name, const 
-        std::string& ipv4);
+        const RecordCache::entry_t& entry);
+    
+    void notifyExpired (
+        const RecordCache::entry_t& entry);
+    
+    void startExpiryTimer ();
+    
+    void timeoutQuery (
+        const queryHandler_t& queryHandler);
+    
+    void scheduleEvent (
+        NameTable::id_t name,
+        uint16_t type,
+        uint64_t when);
+    
+    void scheduleRetransmit (
+        queryHandler_t& queryHandler,
+        uint64_t now);
+    
+    void startQueryTimer ();
+    
+    void query (
+        const std::string& name, 
+        DnsPacket::record_type_t type,
+        std::shared_ptr<CallbackA> callback, 
+        uint32_t timeoutMsecs,
+        bool defer);
+    
+    void resolveAnswer (
+        NameTable::id_t id,
+        DnsPacket::record_type_t type,
+        bool error,
+        const std::string& ipAddress);
+    
+    void finishResolve (
+        NameTable::id_t id,
+        bool error,
+        const std::string& ipAddress);
+    
+    void loadSnapshot (
+        const std::string& path);
     
     int sendPacket (
         uv_udp_t* uv_udp, 
         std::shared_ptr<std::vector<uint8_t>> packet);
     
+    //NOTE: defer leaves the question pending even without a coalescing
+    // window, the caller flushes
+    void enqueueQuestion (
+        const std::string& name,
+        DnsPacket::record_type_t type,
+        bool defer = false);
+    
+    void flushQuestions ();
+    
+    bool isKnownAnswer (
+        const DnsPacket::Packet& packet,
+        const std::map<uv_udp_t*, responseTemplate_t>& templates,
+        uv_udp_t* handleFrom,
+        uint16_t type);
+    
+    void addKnownAnswers (
+        const std::string& name,
+        uint16_t type,
+        std::vector<const RecordCache::entry_t*>& answers);
+    
+    void buildResponseTemplates ();
+    
+    void sendResponse (
+        std::map<uv_udp_t*, responseTemplate_t>& templates,
+        uv_udp_t* handleFrom, 
+        uint32_t ttl,
+        uint16_t transactionId);
+    
     void sendResponseA (
         uv_udp_t* handleFrom, 
         uint32_t ttl);
@@ -2,9 +2,10 @@
 #define __MDNS_DNSPACKET_HPP__
 
 #include <memory>
+#include <ostream>
 #include <vector>
 #include <string>
-#include <list>
+#include <netinet/in.h>
 
 namespace MDns {
 
@@ -30,47 +31,316 @@ public:
         RECORDTYPE_NSEC = 47
     } record_type_t ;
     
+    static const size_t MAX_NAME_LENGTH = 255;
+    static const size_t MAX_LABEL_LENGTH = 63;
+    static const size_t MAX_PACKET_SIZE = 9000; // RFC 6762 17
+    
     typedef enum {
         ENTRYTYPE_ANSWER = 1,
         ENTRYTYPE_AUTHORITY = 2,
         ENTRYTYPE_ADDITIONAL = 3
     } entry_type_t;
     
+    typedef enum {
+        FLAG_RESPONSE  = 0x8000,
+        FLAG_TRUNCATED = 0x0200
+    } flags_t;
+    
     typedef enum {
         CLASS_IN = 1,
         CACHE_FLUSH = 0x8000
     } class_type_t;
     
+    class Packet;
+
+    /**
+     * Non-owning view of a wire-format name inside a parsed datagram.
+     * It is only valid while the Packet (and the bytes it was parsed
+     * from) are alive. Use toString() when an owned copy is needed.
+     */
+    struct Name {
+        const Packet* packet = nullptr;
+        uint16_t      offset = 0;
+
+        std::string toString () const;
+
+        bool equals (
+            const std::string& name) const;
+    };
+
     typedef struct {
-        std::string name;
+        Name name;
         uint16_t qtype;
         uint16_t qclass;
         bool unicast;
     } Question;
     
     typedef struct {
-        std::string name;
+        Name name;
         uint16_t rtype;
         uint16_t rclass;
         uint32_t ttl;
         uint16_t length;
         bool     cacheFlush;
+        Name     target;              // PTR and SRV RECORD, name in rdata
         union {
             struct sockaddr_in  a;    // A RECORD
             struct sockaddr_in6 aaaa; // AAAA RECORD
+            uint8_t nsec[32];         // NSEC RECORD, bitmap of types 0-255
+            struct {
+                uint16_t priority;
+                uint16_t weight;
+                uint16_t port;
+            } srv;                    // SRV RECORD
+            struct {
+                uint16_t offset;      // TXT RECORD, strings span `length`
+            } txt;
         } data;
     } Record;
     
-    typedef struct {
-        uint16_t transactionId;
-        uint16_t flags;
-        uint16_t questionsRRS;
-        uint16_t answerRRS;
-        uint16_t authorityRRS;
-        uint16_t additionalRRS;
-        std::list<std::shared_ptr<Question>> questions;
-        std::list<std::shared_ptr<Record>>   records;
-    } Packet;
+    /**
+     * Decoded packet. Questions and records are kept in contiguous
+     * arrays so a Packet can be reused across datagrams: once its
+     * arrays have grown to the working size, parsing into it does not
+     * allocate. Names point back to the packet, so it is not copyable.
+     */
+    class Packet {
+    public:
+        uint16_t transactionId = 0;
+        uint16_t flags = 0;
+        uint16_t questionsRRS = 0;
+        uint16_t answerRRS = 0;
+        uint16_t authorityRRS = 0;
+        uint16_t additionalRRS = 0;
+        std::vector<Question> questions;
+        std::vector<Record>   records;
+        
+        //NOTE: bytes the packet was parsed from, not owned unless
+        // the packet was parsed from a shared buffer.
+        const uint8_t* data = nullptr;
+        size_t         size = 0;
+        
+        Packet () = default;
+        Packet (const Packet&) = delete;
+        Packet& operator= (const Packet&) = delete;
+        
+        void clear ();
+        
+        /**
+         * Decodes the name at `offset` (RFC 1035 4.1.4), following
+         * compression pointer chains. Suffixes already decoded from this
+         * packet are memoized by offset and reused.
+         * Returns false if the name is malformed.
+         */
+        bool decodeName (
+            uint16_t offset,
+            std::string& out) const;
+        
+    private:
+        friend class DnsPacket;
+        
+        typedef struct {
+            uint16_t offset;
+            uint16_t length;
+            uint32_t start;
+        } suffix_t;
+        
+        std::shared_ptr<std::vector<uint8_t>> _storage;
+        
+        //NOTE: decoded suffixes, keyed by the offset of their first label,
+        // pointing into _suffixText.
+        mutable std::string           _suffixText;
+        mutable std::vector<suffix_t> _suffixes;
+        mutable size_t                _suffixCount = 0;
+        
+        const suffix_t* findSuffix (
+            uint16_t offset) const;
+        
+        void addSuffix (
+            uint16_t offset,
+            uint32_t start,
+            uint16_t length) const;
+    };
+     
+    /**
+     * Walks the entries of a datagram reading only the header and the
+     * fixed fields of each entry. Names are neither decoded nor copied,
+     * which makes it cheap enough to reject uninteresting traffic
+     * before a full Parse.
+     */
+    class Scanner {
+    public:
+        Scanner (
+            const uint8_t* data,
+            size_t size);
+        
+        //NOTE: false if the header is truncated
+        bool valid () const { return _valid; }
+        
+        uint16_t getFlags () const { return _flags; }
+        
+        /**
+         * Moves to the next entry. Returns false at the end of the
+         * datagram or if it is malformed.
+         */
+        bool next ();
+        
+        //NOTE: 0 for questions, otherwise an entry_type_t
+        int getSection () const { return _section; }
+        
+        uint16_t getType () const { return _type; }
+        
+        uint64_t getNameHash () const;
+        
+        bool nameEquals (
+            const std::string& name) const;
+        
+    private:
+        const uint8_t* _data;
+        size_t   _size;
+        size_t   _cursor = 12;
+        bool     _valid = false;
+        uint16_t _flags = 0;
+        uint16_t _counts[4] = { 0, 0, 0, 0 };
+        int      _section = 0;
+        uint16_t _index = 0;
+        uint16_t _type = 0;
+        size_t   _nameOffset = 0;
+    };
+    
+    /**
+     * Whether an NSEC record lists type as existing for its name (RFC
+     * 4034 4.1.2). Types above 255 are always reported as existing.
+     */
+    static bool NsecHasType (
+        const Record& record,
+        uint16_t type);
+    
+    static bool EqualsIgnoreCase (
+        const char* a,
+        const char* b,
+        size_t length);
+    
+    /**
+     * Hashes a name, case insensitively. The wire-format and the dotted
+     * overloads return the same value for the same name.
+     * Returns 0 if the wire-format name is malformed.
+     */
+    static uint64_t HashName (
+        const uint8_t* data,
+        size_t size,
+        size_t offset);
+    
+    static uint64_t HashName (
+        const std::string& name);
+    
+    /**
+     * Incremental packet builder. Every suffix of the names written is
+     * indexed by hash and later names reuse their longest suffix already
+     * in the packet through a compression pointer (RFC 1035 4.1.4).
+     * Entries must be added in section order: questions, answers,
+     * authority and additional records. An entry that would grow the
+     * packet beyond `maxSize` is not added and the call returns false.
+     */
+    class Encoder {
+    public:
+        Encoder (
+            uint16_t flags,
+            size_t maxSize = MAX_PACKET_SIZE);
+        
+        bool addQuestion (
+            const std::string& name,
+            uint16_t qtype,
+            bool unicast = false);
+        
+        bool addRecord (
+            entry_type_t section,
+            const std::string& name,
+            uint16_t rtype,
+            bool cacheFlush,
+            uint32_t ttl,
+            const void* rdata,
+            uint16_t length);
+        
+        bool addRecordA (
+            entry_type_t section,
+            const std::string& name,
+            uint32_t ttl,
+            const struct sockaddr_in* addr,
+            bool cacheFlush = true);
+        
+        bool addRecordAAAA (
+            entry_type_t section,
+            const std::string& name,
+            uint32_t ttl,
+            const struct sockaddr_in6* addr,
+            bool cacheFlush = true);
+        
+        //NOTE: shared record, the target name is compressed as well
+        bool addRecordPTR (
+            entry_type_t section,
+            const std::string& name,
+            uint32_t ttl,
+            const std::string& target);
+        
+        //NOTE: section 0 is questions, otherwise an entry_type_t
+        uint16_t getCount (
+            int section) const;
+        
+        //NOTE: sets the TC bit, more known answers follow (RFC 6762 7.2)
+        void setTruncated ();
+        
+        //NOTE: where the TTL of the last record added was written
+        size_t getLastTtlOffset () const { return _lastTtlOffset; }
+        
+        size_t size () const { return _packet->size(); }
+        
+        std::shared_ptr<std::vector<uint8_t>> getPacket () { return _packet; }
+        
+    private:
+        std::shared_ptr<std::vector<uint8_t>> _packet;
+        size_t _maxSize;
+        int    _section = 0;
+        size_t _lastTtlOffset = 0;
+        
+        typedef struct {
+            uint64_t hash;   // case insensitive, of the labels from offset on
+            uint16_t offset;
+        } suffix_t;
+        
+        //NOTE: suffixes written, candidates for pointers, in the order
+        // they were written so a rolled back entry can drop its own
+        std::vector<suffix_t> _suffixes;
+        size_t _suffixesMark = 0;
+        //NOTE: open addressing index of _suffixes by hash, position + 1,
+        // 0 is empty
+        std::vector<uint32_t> _suffixSlots;
+        
+        size_t begin ();
+        
+        bool commit (
+            size_t mark,
+            int section);
+        
+        void putUint16 (
+            uint16_t value);
+        
+        void putUint32 (
+            uint32_t value);
+        
+        void putName (
+            const std::string& name);
+        
+        const suffix_t* findSuffix (
+            uint64_t hash) const;
+        
+        void addSuffix (
+            uint64_t hash,
+            uint16_t offset);
+        
+        void indexSuffixes (
+            size_t slots);
+    };
      
     static std::shared_ptr<std::vector<uint8_t>> NewQueryA (
         const std::string& name);
@@ -85,8 +355,26 @@ public:
         uint32_t ttl,
         struct sockaddr_in6 *addr);
     
+    /**
+     * Parses a datagram in place. The returned packet and its names
+     * reference `data`, which must outlive them.
+     * Returns nullptr if the datagram is malformed.
+     */
+    static std::shared_ptr<Packet> Parse (
+        const uint8_t* data,
+        size_t size);
+    
     static std::shared_ptr<Packet> Parse (
         std::shared_ptr<std::vector<uint8_t>> buffer);
+    
+    /**
+     * Parses a datagram in place into a caller owned, reusable packet.
+     * Returns false if the datagram is malformed.
+     */
+    static bool Parse (
+        const uint8_t* data,
+        size_t size,
+        Packet& packet);
 
     
 private:
@@ -95,45 +383,65 @@ private:
   
     static uint16_t transactionId;
         
-    static inline uint16_t getUint16 (
-        std::shared_ptr<std::vector<uint8_t>> packet, 
-        size_t &cursor);
-    
-    static inline uint16_t getUint32 (
-        std::shared_ptr<std::vector<uint8_t>> packet, 
-        size_t &cursor);
+    static inline bool getUint16 (
+        const uint8_t* data,
+        size_t size,
+        size_t &cursor,
+        uint16_t& value);
     
-    static std::string getString (
-        std::shared_ptr<std::vector<uint8_t>> buffer, 
-        size_t& offset);
-
-    static inline void addUint16 (
-        std::shared_ptr<std::vector<uint8_t>> packet, 
-        uint16_t value);
+    static inline bool getUint32 (
+        const uint8_t* data,
+        size_t size,
+        size_t &cursor,
+        uint32_t& value);
     
-    static inline void addUint32 (
-        std::shared_ptr<std::vector<uint8_t>> packet, 
-        uint32_t value);
+    static bool skipName (
+        const uint8_t* data,
+        size_t size,
+        size_t& cursor);
     
-    static void addString (
-        std::shared_ptr<std::vector<uint8_t>> packet, 
-        const std::string& name);
-
-    static std::shared_ptr<std::string> getLabel (
-        std::shared_ptr<std::vector<uint8_t>> buffer, 
-        size_t& offset,
-        int32_t &pointerReturnAddress);
+    /**
+     * Reads the next label of a name starting at `cursor`, following
+     * compression pointers. `limit` must start at the name offset:
+     * every pointer has to jump strictly before all positions already
+     * visited, which rules out loops. `length` is 0 at the end of the
+     * name. Returns false if the name is malformed.
+     */
+    static bool nextLabel (
+        const uint8_t* data,
+        size_t size,
+        size_t& cursor,
+        size_t& limit,
+        size_t& labelOffset,
+        uint8_t& length);
     
     static bool isStringPointer (
         uint8_t val);
     
-    static std::shared_ptr<DnsPacket::Record> parseRecord (
-        std::shared_ptr<std::vector<uint8_t>> buffer,
+    /**
+     * Compares the wire-format name at `offset` with a dotted name
+     * without decoding it, case insensitively.
+     */
+    static bool matchName (
+        const uint8_t* data,
+        size_t size,
+        size_t offset,
+        const char* name,
+        size_t nameLength);
+    
+    static bool parseRecord (
+        const uint8_t* data,
+        size_t size,
         size_t& offset,
-        entry_type_t type);
+        entry_type_t type,
+        Record& record);
     
 };
 
+std::ostream& operator<< (
+    std::ostream& os, 
+    const DnsPacket::Name& name);
+
 }
 
 #endif
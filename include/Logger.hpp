@@ -29,6 +29,8 @@ public:
     
     static void setLogLevel (
         LOG_LEVEL level);
+    
+    static LOG_LEVEL getLogLevel ();
   
     void setLogFunction (
         std::function<void(LOG_LEVEL level, 
@@ -37,7 +39,7 @@ public:
     
     template <typename... Args> 
     void debug (
-        const std::string& fmt_str, 
+        const char* fmt_str, 
         const Args &... args) 
     {
         formatAndPrint (DEBUG, fmt_str, args...); 
@@ -45,7 +47,7 @@ public:
 
     template <typename... Args> 
     void info (
-        const std::string& fmt_str, 
+        const char* fmt_str, 
         const Args &... args) 
     {
         formatAndPrint (INFO,  fmt_str, args...); 
@@ -53,7 +55,7 @@ public:
 
     template <typename... Args> 
     void warn (
-        const std::string& fmt_str, 
+        const char* fmt_str, 
         const Args &... args) 
     {
         formatAndPrint (WARN,  fmt_str, args...); 
@@ -61,12 +63,46 @@ public:
 
     template <typename... Args> 
     void error (
-        const std::string& fmt_str, 
+        const char* fmt_str, 
         const Args &... args) 
     {
         formatAndPrint (ERROR, fmt_str, args...); 
     }
     
+    //NOTE: std::string formats are still accepted, literals take the
+    // overloads above and build no string when the level is disabled
+    template <typename... Args> 
+    void debug (
+        const std::string& fmt_str, 
+        const Args &... args) 
+    {
+        formatAndPrint (DEBUG, fmt_str.c_str(), args...); 
+    }
+
+    template <typename... Args> 
+    void info (
+        const std::string& fmt_str, 
+        const Args &... args) 
+    {
+        formatAndPrint (INFO,  fmt_str.c_str(), args...); 
+    }
+
+    template <typename... Args> 
+    void warn (
+        const std::string& fmt_str, 
+        const Args &... args) 
+    {
+        formatAndPrint (WARN,  fmt_str.c_str(), args...); 
+    }
+
+    template <typename... Args> 
+    void error (
+        const std::string& fmt_str, 
+        const Args &... args) 
+    {
+        formatAndPrint (ERROR, fmt_str.c_str(), args...); 
+    }
+    
 private:
   
     static LOG_LEVEL _logLevel;
@@ -115,12 +151,12 @@ private:
     template <typename... Args> 
     void formatAndPrint (
         LOG_LEVEL level, 
-        const std::string& fmt_str, 
+        const char* fmt_str, 
         const Args &... args) 
     {
         if (level <= _logLevel) {
             std::string line = "";
-            xsprintf (line, fmt_str.c_str(), args...);
+            xsprintf (line, fmt_str, args...);
             if (_logFunction == nullptr) {
                 std::cerr 
                 << "-" << levelToString (level) << "-"
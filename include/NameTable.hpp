@@ -0,0 +1,104 @@
+#ifndef __MDNS_NAMETABLE_HPP__
+#define __MDNS_NAMETABLE_HPP__
+
+#include <string>
+#include <vector>
+#include "Logger.hpp"
+#include "DnsPacket.hpp"
+
+namespace MDns {
+
+/**
+ * Interned DNS names.
+ *
+ * Every distinct name (compared case insensitively) is stored once and
+ * gets a small integer id, stable while it is referenced. Holders of a
+ * name compare and hash ids instead of strings. Ids are reference
+ * counted, a name is dropped when its last holder releases it and its
+ * id is reused afterwards.
+ *
+ * Wire-format names from a parsed packet are looked up without being
+ * decoded, they are only decoded when interned for the first time.
+ */
+class NameTable {
+
+public:
+
+    typedef uint32_t id_t;
+
+    static const id_t INVALID_ID = 0;
+
+    NameTable ();
+
+    /**
+     * Id of name, adding it if missing. Takes a reference, release() it.
+     */
+    id_t intern (
+        const std::string& name);
+
+    //NOTE: INVALID_ID if the name is malformed
+    id_t intern (
+        const DnsPacket::Name& name,
+        uint64_t hash);
+
+    /**
+     * Id of name without taking a reference, INVALID_ID if missing.
+     */
+    id_t find (
+        const std::string& name) const;
+
+    id_t find (
+        const DnsPacket::Name& name,
+        uint64_t hash) const;
+
+    void retain (
+        id_t id);
+
+    void release (
+        id_t id);
+
+    const std::string& name (
+        id_t id) const
+    {
+        return _names[id - 1].name;
+    }
+
+    uint64_t hash (
+        id_t id) const
+    {
+        return _names[id - 1].hash;
+    }
+
+    size_t size () const { return _size; }
+
+private:
+
+    static std::shared_ptr<Logger> LOG;
+
+    typedef struct {
+        std::string name;
+        uint64_t    hash;
+        uint32_t    refs;
+    } name_t;
+
+    //NOTE: slab of names indexed by id - 1, slots hold the id (0 is empty)
+    std::vector<name_t>   _names;
+    std::vector<id_t>     _freeIds;
+    std::vector<id_t>     _slots;
+    size_t                _size = 0;
+
+    template <typename M>
+    id_t findId (
+        uint64_t hash,
+        M matches) const;
+
+    name_t& add (
+        uint64_t hash,
+        id_t& id);
+
+    void grow ();
+};
+
+}
+
+#endif
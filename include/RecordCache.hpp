@@ -0,0 +1,419 @@
+#ifndef __MDNS_RECORDCACHE_HPP__
+#define __MDNS_RECORDCACHE_HPP__
+
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include "Logger.hpp"
+#include "DnsPacket.hpp"
+#include "TimerWheel.hpp"
+#include "NameTable.hpp"
+
+namespace MDns {
+
+class CacheSnapshot;
+
+/**
+ * A/AAAA record cache.
+ *
+ * Entries live in a slab and are indexed by an open addressing table
+ * keyed by (name hash, record type), so lookups and inserts are O(1).
+ * Names are interned in a NameTable shared with the owner, entries hold
+ * a name id and compare ids. Names are hashed once per received record
+ * and addresses are kept in binary. Refreshing an existing entry does
+ * not allocate.
+ *
+ * An entry is one record, the entries sharing (name, type) form its
+ * RRset, so a multi-homed host keeps all its addresses.
+ *
+ * Negative entries record that a (name, type) does not exist, from
+ * an NSEC record or a query that timed out. They hold no address and
+ * are only seen through isNegative().
+ *
+ * The cache can be capped, the least recently inserted or looked up
+ * entries are evicted first.
+ *
+ * Every entry has a timer in a timing wheel, expire() removes entries
+ * when their TTL runs out. Entries looked up within their last TTL are
+ * hot, their timer also fires at 80, 85, 90 and 95% of the TTL so the
+ * owner can send refresh queries (RFC 6762 5.2).
+ *
+ * An optional CacheSnapshot mirrors every change to disk.
+ */
+class RecordCache {
+
+public:
+
+    typedef union {
+        struct in_addr  v4;
+        struct in6_addr v6;
+    } address_t;
+
+    typedef struct {
+        NameTable::id_t name;
+        uint64_t    hash;       // of the name
+        uint16_t    type;
+        uint32_t    ttl;        // TTL the record was received with
+        uint64_t    received;   // msecs, loop time
+        uint64_t    expiration; // msecs, loop time
+        uint64_t    lastLookup; // msecs, loop time, 0 never
+        uint8_t     refreshes;  // refresh points passed since received
+        address_t   address;
+        TimerWheel::handle_t timer;
+        uint32_t    lruPrev;
+        uint32_t    lruNext;
+        bool        negative;
+        bool        used;
+    } entry_t;
+
+    //NOTE: names must outlive the cache
+    RecordCache (
+        NameTable& names,
+        uint64_t now);
+
+    typedef struct {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t expirations;
+        uint64_t negativeHits;
+    } stats_t;
+
+    /**
+     * Most recently received record of the (name, type) RRset that has
+     * not expired. Counts a hit or a miss, a hit touches the RRset.
+     */
+    const entry_t* lookup (
+        const std::string& name,
+        uint16_t type,
+        uint64_t now);
+
+    const entry_t* find (
+        const DnsPacket::Name& name,
+        uint64_t hash,
+        uint16_t type,
+        const address_t& address) const;
+
+    /**
+     * Inserts or refreshes the record (name, type, address). The name is
+     * only decoded and copied when the record is new.
+     */
+    const entry_t* update (
+        const DnsPacket::Name& name,
+        uint64_t hash,
+        uint16_t type,
+        uint32_t ttl,
+        const address_t& address,
+        uint64_t now);
+
+    const entry_t* update (
+        const std::string& name,
+        uint16_t type,
+        uint32_t ttl,
+        const address_t& address,
+        uint64_t now);
+
+    /**
+     * Re-inserts a record from a snapshot, expiring remaining msecs
+     * from now.
+     */
+    const entry_t* restore (
+        const std::string& name,
+        uint16_t type,
+        uint32_t ttl,
+        const address_t& address,
+        uint64_t remaining,
+        uint64_t now);
+
+    /**
+     * Records that (name, type) does not exist for lifetime msecs. A
+     * positive record for it removes the negative entry.
+     */
+    void addNegative (
+        const DnsPacket::Name& name,
+        uint64_t hash,
+        uint16_t type,
+        uint64_t lifetime,
+        uint64_t now);
+
+    void addNegative (
+        const std::string& name,
+        uint16_t type,
+        uint64_t lifetime,
+        uint64_t now);
+
+    /**
+     * Whether (name, type) is known not to exist at now, counts a
+     * negative hit.
+     */
+    bool isNegative (
+        const std::string& name,
+        uint16_t type,
+        uint64_t now);
+
+    bool eraseNegative (
+        const DnsPacket::Name& name,
+        uint64_t hash,
+        uint16_t type);
+
+    /**
+     * RFC 6762 10.2: a record with the cache-flush bit replaces the
+     * RRset. Records received more than one second before now expire
+     * one second from now, newer ones belong to the same announcement
+     * and are kept.
+     */
+    void flush (
+        const DnsPacket::Name& name,
+        uint64_t hash,
+        uint16_t type,
+        uint64_t now);
+
+    bool erase (
+        const DnsPacket::Name& name,
+        uint64_t hash,
+        uint16_t type,
+        const address_t& address);
+
+    size_t size () const { return _size; }
+
+    const std::string& getName (
+        const entry_t& entry) const
+    {
+        return _names.name (entry.name);
+    }
+
+    /**
+     * Marks the (name, type) RRset as looked up, keeps it refreshed and
+     * moves it to the front of the LRU list.
+     */
+    void touch (
+        const std::string& name,
+        uint16_t type,
+        uint64_t now);
+
+    /**
+     * Least recently used entries are evicted beyond maxEntries, 0 is
+     * unlimited.
+     */
+    void setMaxEntries (
+        size_t maxEntries);
+
+    const stats_t& getStats () const { return _stats; }
+
+    //NOTE: changes whenever a record is stored, removed or its address
+    // or expiration changes, not on lookups
+    uint64_t version () const { return _version; }
+
+    //NOTE: not owned, nullptr disables it
+    void setSnapshot (
+        CacheSnapshot* snapshot);
+
+    template <typename F>
+    void forEach (F f) const {
+        for (auto& entry: _entries) {
+            if (entry.used && !entry.negative) {
+                f (entry);
+            }
+        }
+    }
+
+    /**
+     * Calls f (entry) for every record of the (name, type) RRset, f must
+     * not modify the cache.
+     */
+    template <typename F>
+    void forEachRecord (
+        const std::string& name,
+        uint16_t type,
+        F f) const
+    {
+        NameTable::id_t id = _names.find (name);
+        if (id == NameTable::INVALID_ID) {
+            return;
+        }
+        size_t mask = _slots.size() - 1;
+        for (size_t i = home (_names.hash (id), type, mask); _slots[i] != 0; i = (i + 1) & mask) {
+            const entry_t& entry = _entries[_slots[i] - 1];
+            if (entry.name == id && entry.type == type && !entry.negative) {
+                f (entry);
+            }
+        }
+    }
+
+    /**
+     * Removes the entries expired at now, expired (entry) gets a copy of
+     * each one after it is removed. refresh (entry) is called for hot
+     * entries reaching a refresh point, it must not modify the cache.
+     */
+    template <typename F, typename R>
+    void expire (
+        uint64_t now,
+        F expired,
+        R refresh)
+    {
+        _expiry.advance (now, [&](uint32_t index) {
+            entry_t& entry = _entries[index];
+            entry.timer = TimerWheel::INVALID_HANDLE;
+            if (entry.negative) {
+                eraseEntry (index);
+                return;
+            }
+            if (now < entry.expiration) {
+                bool hot = isHot (entry, now);
+                if (hot) {
+                    entry.refreshes++;
+                }
+                schedule (entry, now);
+                if (hot) {
+                    refresh (entry);
+                }
+                return;
+            }
+            //NOTE: the copy keeps its name alive for the callback
+            entry_t expiredEntry = entry;
+            _names.retain (expiredEntry.name);
+            eraseEntry (index);
+            _stats.expirations++;
+            expired (expiredEntry);
+            _names.release (expiredEntry.name);
+        });
+    }
+
+    /**
+     * Msecs until expire() has work to do, -1 if the cache is empty.
+     */
+    int64_t nextTimeout (
+        uint64_t now) const
+    {
+        return _expiry.nextTimeout (now);
+    }
+
+    static size_t AddressLength (
+        uint16_t type);
+    
+    /**
+     * Refresh point `refreshes` (0 for 80% of the TTL, then 85, 90 and
+     * 95%) of a record received at `received`, plus jitter thousandths
+     * of the TTL. 0 past the last one (RFC 6762 5.2).
+     */
+    static uint64_t RefreshPoint (
+        uint64_t received,
+        uint32_t ttl,
+        uint8_t refreshes,
+        uint32_t jitter = 0);
+
+    //NOTE: text form of an entry address, for logs and callbacks
+    static std::string AddressToString (
+        const entry_t& entry);
+
+private:
+
+    static std::shared_ptr<Logger> LOG;
+
+    NameTable&            _names;
+
+    //NOTE: slab of entries, slots hold entry index + 1 (0 is empty)
+    std::vector<entry_t>  _entries;
+    std::vector<uint32_t> _freeEntries;
+    std::vector<uint32_t> _slots;
+    size_t                _size = 0;
+    TimerWheel            _expiry;
+    CacheSnapshot*        _snapshot = nullptr;
+    uint32_t              _random;
+    size_t                _maxEntries = 0;
+    size_t                _negatives = 0;
+    stats_t               _stats = {};
+    uint64_t              _version = 0;
+
+    //NOTE: LRU list through the entries, most recently used first
+    uint32_t              _lruHead = 0xFFFFFFFFU;
+    uint32_t              _lruTail = 0xFFFFFFFFU;
+
+    static size_t home (
+        uint64_t hash,
+        uint16_t type,
+        size_t mask)
+    {
+        return (size_t)(hash ^ (type * 0x9e3779b97f4a7c15ULL)) & mask;
+    }
+
+    static bool sameAddress (
+        const entry_t& entry,
+        const address_t& address);
+
+    template <typename M>
+    size_t findSlot (
+        uint64_t hash,
+        uint16_t type,
+        M matches) const;
+
+    //NOTE: the entry takes over a reference to id
+    entry_t& insert (
+        NameTable::id_t id,
+        uint16_t type);
+
+    //NOTE: takes over a reference to id
+    const entry_t* update (
+        NameTable::id_t id,
+        uint16_t type,
+        uint32_t ttl,
+        const address_t& address,
+        uint64_t now);
+
+    void refresh (
+        entry_t& entry,
+        uint32_t ttl,
+        const address_t& address,
+        uint64_t now);
+
+    //NOTE: moves the entry timer to its next deadline
+    void schedule (
+        entry_t& entry,
+        uint64_t now);
+    
+    //NOTE: bumps the version and mirrors the entry to the snapshot
+    void changed (
+        const entry_t& entry,
+        uint64_t now);
+
+    //NOTE: next time the entry timer has to fire
+    uint64_t deadline (
+        entry_t& entry,
+        uint64_t now);
+
+    static bool isHot (
+        const entry_t& entry,
+        uint64_t now);
+
+    void eraseSlot (
+        size_t slot);
+
+    void eraseEntry (
+        uint32_t index);
+
+    void grow ();
+
+    //NOTE: takes over a reference to id
+    void negative (
+        NameTable::id_t id,
+        uint16_t type,
+        uint64_t lifetime,
+        uint64_t now);
+
+    void touch (
+        NameTable::id_t id,
+        uint16_t type,
+        uint64_t now);
+
+    void evict ();
+
+    void lruPush (
+        uint32_t index);
+
+    void lruUnlink (
+        uint32_t index);
+};
+
+}
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef __MDNS_TIMERWHEEL_HPP__
+#define __MDNS_TIMERWHEEL_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace MDns {
+
+/**
+ * Hierarchical timing wheel.
+ *
+ * 4 levels of 64 slots, a timer is placed in the level that covers its
+ * distance to the current tick and moves down a level when its slot
+ * comes up. Scheduling, rescheduling and cancelling are O(1), expiring
+ * is amortized O(1) per timer. Empty stretches of the wheel are skipped
+ * using a bitmap of occupied slots per level, so the loop timer driving
+ * it only wakes up when something has to be done.
+ *
+ * Time is in msecs, the caller supplies it (usually uv_now). Timers
+ * never fire before their deadline, at most one tick after it.
+ */
+class TimerWheel {
+
+public:
+
+    typedef uint32_t handle_t;
+    static const handle_t INVALID_HANDLE = 0xFFFFFFFFU;
+
+    TimerWheel (
+        uint64_t now,
+        uint32_t resolution = 1);
+
+    handle_t schedule (
+        uint64_t deadline,
+        uint32_t data);
+
+    void reschedule (
+        handle_t handle,
+        uint64_t deadline);
+
+    void cancel (
+        handle_t handle);
+
+    /**
+     * Msecs until the wheel needs to be advanced again, -1 if there
+     * are no timers.
+     */
+    int64_t nextTimeout (
+        uint64_t now) const;
+
+    /**
+     * Fires every timer whose deadline is <= now, expired (data) is
+     * called after the timer is released, so it may schedule or cancel
+     * timers.
+     */
+    template <typename F>
+    void advance (
+        uint64_t now,
+        F expired)
+    {
+        uint64_t target = now / _resolution;
+        while (true) {
+            uint64_t tick = nextTick();
+            if (tick == NO_TICK || tick > target) {
+                break;
+            }
+            _current = tick;
+            cascade (tick);
+
+            uint32_t& head = _slots[0][tick & SLOT_MASK];
+            while (head != NIL) {
+                uint32_t index = head;
+                uint32_t data  = _nodes[index].data;
+                release (index);
+                expired (data);
+            }
+        }
+        if (target > _current) {
+            _current = target;
+        }
+    }
+
+    size_t size () const { return _size; }
+
+private:
+
+    static const int      LEVELS     = 4;
+    static const int      SLOT_BITS  = 6;
+    static const uint32_t SLOTS      = 1 << SLOT_BITS;
+    static const uint64_t SLOT_MASK  = SLOTS - 1;
+    static const uint32_t NIL        = 0xFFFFFFFFU;
+    static const uint64_t NO_TICK    = (uint64_t)-1;
+
+    typedef struct {
+        uint64_t deadline; // ticks
+        uint32_t data;
+        uint32_t next;
+        uint32_t prev;
+        uint8_t  level;
+        uint8_t  slot;
+        bool     used;
+    } node_t;
+
+    uint32_t _resolution;
+    uint64_t _current;
+    size_t   _size = 0;
+
+    //NOTE: slab of timers, free ones are chained through next
+    std::vector<node_t> _nodes;
+    uint32_t            _free = NIL;
+
+    uint32_t _slots[LEVELS][SLOTS];
+    uint64_t _occupied[LEVELS];
+
+    void link (
+        uint32_t index);
+
+    void unlink (
+        uint32_t index);
+
+    void release (
+        uint32_t index);
+
+    void cascade (
+        uint64_t tick);
+
+    uint64_t nextTick () const;
+};
+
+}
+
+#endif
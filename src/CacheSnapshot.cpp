@@ -0,0 +1,186 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "CacheSnapshot.hpp"
+
+namespace MDns {
+
+std::shared_ptr<Logger> CacheSnapshot::LOG = Logger::Get("CacheSnapshot");
+
+std::unique_ptr<CacheSnapshot> CacheSnapshot::Open (
+    const std::string& path)
+{
+    std::unique_ptr<CacheSnapshot> snapshot (new CacheSnapshot());
+
+    snapshot->_fd = open (path.c_str(), O_RDWR | O_CREAT, 0600);
+    if (snapshot->_fd < 0) {
+        LOG->error ("Open: cannot open: % errno: %", path, errno);
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat (snapshot->_fd, &st) != 0) {
+        LOG->error ("Open: cannot stat: % errno: %", path, errno);
+        return nullptr;
+    }
+
+    header_t header;
+    memset (&header, 0, sizeof(header));
+    if ((size_t)st.st_size >= sizeof(header)) {
+        if (pread (snapshot->_fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            memset (&header, 0, sizeof(header));
+        }
+    }
+
+    bool valid = header.magic == MAGIC &&
+                 header.version == VERSION &&
+                 (size_t)st.st_size == sizeof(header_t) + header.slots * sizeof(slot_t);
+
+    if (!valid) {
+        LOG->info ("Open: new snapshot: %", path);
+        if (ftruncate (snapshot->_fd, 0) != 0 || !snapshot->map (INITIAL_SLOTS)) {
+            return nullptr;
+        }
+        snapshot->header()->magic   = MAGIC;
+        snapshot->header()->version = VERSION;
+    } else if (!snapshot->map (header.slots)) {
+        return nullptr;
+    }
+
+    return snapshot;
+}
+
+CacheSnapshot::~CacheSnapshot ()
+{
+    if (_data != nullptr) {
+        munmap (_data, _size);
+    }
+    if (_fd >= 0) {
+        close (_fd);
+    }
+}
+
+bool CacheSnapshot::map (
+    uint32_t slots)
+{
+    size_t size = sizeof(header_t) + slots * sizeof(slot_t);
+
+    if (_data != nullptr) {
+        munmap (_data, _size);
+        _data = nullptr;
+        _size = 0;
+    }
+
+    struct stat st;
+    if (fstat (_fd, &st) != 0 || ((size_t)st.st_size < size && ftruncate (_fd, size) != 0)) {
+        LOG->error ("map: cannot resize to: % errno: %", size, errno);
+        return false;
+    }
+
+    void* data = mmap (nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (data == MAP_FAILED) {
+        LOG->error ("map: mmap failed errno: %", errno);
+        return false;
+    }
+
+    _data = (uint8_t*) data;
+    _size = size;
+    header()->slots = slots;
+    return true;
+}
+
+std::vector<CacheSnapshot::record_t> CacheSnapshot::load () const
+{
+    std::vector<record_t> records;
+    if (_data == nullptr) {
+        return records;
+    }
+
+    uint64_t now = WallClock();
+    for (uint32_t i = 0; i < header()->slots; i++) {
+
+        const slot_t* s = slot (i);
+        if (!s->used || s->expiration <= now) {
+            continue;
+        }
+        if (s->type != DnsPacket::RECORDTYPE_A && s->type != DnsPacket::RECORDTYPE_AAAA) {
+            LOG->warn ("load: bad record type: % at slot: %", s->type, i);
+            continue;
+        }
+
+        record_t record;
+        record.name.assign (s->name, s->nameLength);
+        record.type = s->type;
+        record.ttl  = s->ttl;
+        record.remaining = s->expiration - now;
+        memcpy (&record.address, s->address, RecordCache::AddressLength (s->type));
+        records.push_back (record);
+    }
+
+    LOG->info ("load: % valid records", records.size());
+    return records;
+}
+
+void CacheSnapshot::clear ()
+{
+    if (_data == nullptr) {
+        return;
+    }
+    for (uint32_t i = 0; i < header()->slots; i++) {
+        slot(i)->used = 0;
+    }
+}
+
+void CacheSnapshot::store (
+    uint32_t index,
+    const RecordCache::entry_t& entry,
+    const std::string& name,
+    uint64_t now)
+{
+    if (_data == nullptr) {
+        return;
+    }
+
+    if (index >= header()->slots) {
+        uint32_t slots = header()->slots * 2;
+        while (index >= slots) {
+            slots *= 2;
+        }
+        if (!map (slots)) {
+            return;
+        }
+    }
+
+    //NOTE: used is cleared while the slot is rewritten, a crash in
+    // between loses the record instead of leaving a mixed one
+    slot_t* s = slot (index);
+    s->used = 0;
+    s->nameLength = name.size() < DnsPacket::MAX_NAME_LENGTH ? name.size() : DnsPacket::MAX_NAME_LENGTH;
+    memcpy (s->name, name.data(), s->nameLength);
+    s->type = entry.type;
+    s->ttl  = entry.ttl;
+    s->expiration = WallClock() + (entry.expiration > now ? entry.expiration - now : 0);
+    memcpy (s->address, &entry.address, RecordCache::AddressLength (entry.type));
+    s->used = 1;
+}
+
+void CacheSnapshot::remove (
+    uint32_t index)
+{
+    if (_data != nullptr && index < header()->slots) {
+        slot(index)->used = 0;
+    }
+}
+
+uint64_t CacheSnapshot::WallClock ()
+{
+    struct timeval tv;
+    gettimeofday (&tv, nullptr);
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+}
@@ -0,0 +1,147 @@
+#include <uv.h>
+#include "CacheView.hpp"
+
+namespace MDns {
+
+std::shared_ptr<Logger> CacheView::LOG = Logger::Get("CacheView");
+
+CacheView::CacheView () :
+    _current (new table_t()),
+    _epoch (0)
+{
+    _readers[0] = 0;
+    _readers[1] = 0;
+    _current.load()->slots.assign (MIN_SLOTS, 0);
+}
+
+CacheView::~CacheView ()
+{
+    //NOTE: readers must be gone, they are on the owner lifetime
+    delete _retired;
+    delete _current.load();
+}
+
+bool CacheView::publish (
+    const RecordCache& cache,
+    uint64_t now)
+{
+    if (!reclaim()) {
+        return false;
+    }
+
+    table_t* table = new table_t();
+    uint64_t viewNow = Now();
+
+    table->records.reserve (cache.size());
+    table->hashes.reserve (cache.size());
+    cache.forEach ([&](const RecordCache::entry_t& entry) {
+        if (entry.expiration <= now) {
+            return;
+        }
+        record_t record;
+        record.name = cache.getName (entry);
+        record.type = entry.type;
+        record.address = entry.address;
+        record.expiration = viewNow + (entry.expiration - now);
+        table->records.push_back (record);
+        table->hashes.push_back (entry.hash);
+    });
+
+    //NOTE: load factor under 1/2
+    size_t slots = MIN_SLOTS;
+    while (slots < table->records.size() * 2) {
+        slots *= 2;
+    }
+    table->slots.assign (slots, 0);
+    for (size_t index = 0; index < table->records.size(); index++) {
+        size_t i = (table->hashes[index] ^ table->records[index].type) & (slots - 1);
+        while (table->slots[i] != 0) {
+            i = (i + 1) & (slots - 1);
+        }
+        table->slots[i] = index + 1;
+    }
+
+    table_t* old = _current.exchange (table);
+    uint64_t epoch = _epoch.fetch_add (1);
+
+    _retired = old;
+    _retiredParity = epoch & 1;
+    reclaim();
+
+    LOG->debug ("publish: % records", table->records.size());
+    return true;
+}
+
+bool CacheView::reclaim ()
+{
+    if (_retired == nullptr) {
+        return true;
+    }
+    if (_readers[_retiredParity].load() != 0) {
+        return false;
+    }
+    delete _retired;
+    _retired = nullptr;
+    return true;
+}
+
+bool CacheView::lookup (
+    const std::string& name,
+    uint16_t type,
+    RecordCache::address_t& address) const
+{
+    uint64_t hash = DnsPacket::HashName (name);
+    uint64_t now = Now();
+    bool found = false;
+
+    read ([&](const table_t* table) {
+        uint64_t best = 0;
+        size_t mask = table->slots.size() - 1;
+        for (size_t i = (hash ^ type) & mask; table->slots[i] != 0; i = (i + 1) & mask) {
+            size_t index = table->slots[i] - 1;
+            const record_t& record = table->records[index];
+            if (table->hashes[index] != hash || 
+                record.type != type || 
+                record.expiration <= now || 
+                record.expiration <= best ||
+                record.name.size() != name.size() ||
+                !DnsPacket::EqualsIgnoreCase (record.name.data(), name.data(), name.size())) 
+            {
+                continue;
+            }
+            best = record.expiration;
+            address = record.address;
+            found = true;
+        }
+    });
+
+    return found;
+}
+
+std::vector<CacheView::record_t> CacheView::records () const
+{
+    std::vector<record_t> records;
+    read ([&](const table_t* table) {
+        records = table->records;
+    });
+    return records;
+}
+
+uint64_t CacheView::Now ()
+{
+    return uv_hrtime() / 1000000;
+}
+
+std::string CacheView::AddressToString (
+    const record_t& record)
+{
+    char address[INET6_ADDRSTRLEN] = { 0 };
+    if (record.type == DnsPacket::RECORDTYPE_AAAA) {
+        uv_inet_ntop (AF_INET6, &record.address.v6, address, sizeof(address));
+    } else {
+        uv_inet_ntop (AF_INET, &record.address.v4, address, sizeof(address));
+    }
+    return address;
+}
+
+}
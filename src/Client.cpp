@@ -1,5 +1,6 @@
 #include <string.h>
 #include <stdio.h>
+#include <algorithm>
 #include <unistd.h>
 #include <ifaddrs.h>
 #include <net/if.h>
@@ -15,8 +16,11 @@ void Client::libuvAllocCallback (
     size_t suggested_size, 
     uv_buf_t* buf) 
 {
-    buf->base = (char*) malloc (suggested_size);
-    buf->len = suggested_size;
+    //NOTE: every datagram is fully handled before the next one is read,
+    // so one receive buffer per client is reused for all of them.
+    auto mdns = (Client*)handle->data;
+    buf->base = (char*) mdns->_recvBuffer.data();
+    buf->len = mdns->_recvBuffer.size();
 }
 
 void Client::libuvHandleUdpDatagram (
@@ -55,114 +59,318 @@ void Client::handleUdpDatagram (
         LOG->debug ("libuvHandleUdpDatagram: empty datagram");
     } else if (flags == UV_UDP_PARTIAL) {
         LOG->debug ("libuvHandleUdpDatagram: partial UDP datagram");
+    } else if (!mdns->acceptDatagram ((const uint8_t*)buf->base, nread)) {
+        LOG->debug ("libuvHandleUdpDatagram: nothing of interest, dropped");
     } else {
       
-        std::string ipaddress;
+        //NOTE: find, a lookup must not add the handle to the interfaces
+        auto itIface = mdns->_udpHandleToInterface.find (handle);
+        if (itIface == mdns->_udpHandleToInterface.end()) {
+            LOG->debug ("libuvHandleUdpDatagram: unknown handle, dropped");
+            return;
+        }
+      
+        char ipaddress[129] = { 0 };
         
-        std::string iface = mdns->_udpHandleToInterface[handle].name;
+        const std::string& iface = itIface->second.name;
       
         if (addr->sa_family == AF_INET) {
-            char sender[17] = { 0 };
-            uv_ip4_name((struct sockaddr_in*) addr, sender, 16);
-            ipaddress = sender;
-            LOG->debug ("Recv from IPv4 %", sender);
+            uv_ip4_name((struct sockaddr_in*) addr, ipaddress, 16);
+            LOG->debug ("Recv from IPv4 %", ipaddress);
         } else if (addr->sa_family == AF_INET6) {      
-            char sender[129] = { 0 };
-            uv_ip6_name ((struct sockaddr_in6*) addr, sender, 128);           
-            ipaddress = sender;
-            LOG->debug ("Recv from IPv6 %", sender);
+            uv_ip6_name ((struct sockaddr_in6*) addr, ipaddress, 128);           
+            LOG->debug ("Recv from IPv6 %", ipaddress);
         }
 
         LOG->info ("Received packet len: %", nread);
-        auto buffer = std::make_shared<std::vector<uint8_t>> ((uint8_t*)buf->base, (uint8_t*)buf->base+nread);
-        auto packet = DnsPacket::Parse (buffer);
+        //NOTE: parsed in place into the reusable packet, names reference buf->base
+        auto& packet = mdns->_recvPacket;
         
-        if (packet) {
+        if (DnsPacket::Parse ((const uint8_t*)buf->base, nread, packet)) {
           
-            for (auto &question: packet->questions) {
-                if (question->qtype == DnsPacket::RECORDTYPE_A) {
-                    if (question->name == mdns->_uuid) {
-                        LOG->info ("Received QUESTION TYPE A to me: % from [% @ %]", question->name, ipaddress, iface);
-                        mdns->sendResponseA (handle, DEFAULT_TTL);
+            for (auto &question: packet.questions) {
+                if (question.qtype == DnsPacket::RECORDTYPE_A) {
+                    if (question.name.equals (mdns->_uuid)) {
+                        LOG->info ("Received QUESTION TYPE A to me: % from [% @ %]", question.name, ipaddress, iface);
+                        if (mdns->isKnownAnswer (packet, mdns->_responseTemplatesA, handle, DnsPacket::RECORDTYPE_A)) {
+                            LOG->info ("Known answer for QUESTION TYPE A, not responding");
+                        } else {
+                            mdns->sendResponseA (handle, DEFAULT_TTL);
+                        }
                     }   
-                } else if (question->qtype == DnsPacket::RECORDTYPE_AAAA) {
-                    if (question->name == mdns->_uuid) {
-                        LOG->info ("Received QUESTION TYPE AAAA to me: % from [% @ %]", question->name, ipaddress, iface);
-                        mdns->sendResponseAAAA (handle, DEFAULT_TTL);
+                } else if (question.qtype == DnsPacket::RECORDTYPE_AAAA) {
+                    if (question.name.equals (mdns->_uuid)) {
+                        LOG->info ("Received QUESTION TYPE AAAA to me: % from [% @ %]", question.name, ipaddress, iface);
+                        if (mdns->isKnownAnswer (packet, mdns->_responseTemplatesAAAA, handle, DnsPacket::RECORDTYPE_AAAA)) {
+                            LOG->info ("Known answer for QUESTION TYPE AAAA, not responding");
+                        } else {
+                            mdns->sendResponseAAAA (handle, DEFAULT_TTL);
+                        }
                     }   
                 } else {
-                    LOG->info ("Received QUESTION TYPE: % name: % - IGNORING IT", question->qtype, question->name);
+                    LOG->info ("Received QUESTION TYPE: % name: % - IGNORING IT", question.qtype, question.name);
                 }
             }
           
-            for (auto &record: packet->records) {
-                if (record->rtype == DnsPacket::RECORDTYPE_A) {                                        
-
-                    time_t expirationTime = time(nullptr)+record->ttl;
-                    char ipv4address[17] = { 0 };
-                    uv_ip4_name (&record->data.a, ipv4address, 16);
-
-                    LOG->info ("Received RECORD TYPE A ttl: %: % => % [CACHE FLUSH: %] from [% @ %]", 
-                                   record->ttl,
-                                   record->name, ipv4address, record->cacheFlush, ipaddress, iface);
+            for (auto &record: packet.records) {
+                if (!(packet.flags & DnsPacket::FLAG_RESPONSE)) {
+                    //NOTE: records in a query are known answers, not
+                    // announcements, they must not be cached
+                    LOG->debug ("Received known answer: % type: %", record.name, record.rtype);
+                } else if (record.rtype == DnsPacket::RECORDTYPE_A ||
+                           record.rtype == DnsPacket::RECORDTYPE_AAAA) 
+                {
+                    LOG->info ("Received RECORD TYPE % ttl: %: % [CACHE FLUSH: %] from [% @ %]", 
+                                   record.rtype == DnsPacket::RECORDTYPE_A ? "A" : "AAAA",
+                                   record.ttl,
+                                   record.name, record.cacheFlush, ipaddress, iface);
                     
-                    if (record->ttl == 0) { // Remove
-                        mdns->_recordsA.erase (record->name);
-                    } else {                    
-                        mdns->_recordsA[record->name] = std::make_pair (expirationTime, std::string(ipv4address));
-                        mdns->printCache();
-                        mdns->notify (DnsPacket::RECORDTYPE_A, record->name, ipv4address);
-                    }            
+                    mdns->cacheRecord (packet, record);
                     
-                } else if (record->rtype == DnsPacket::RECORDTYPE_AAAA) {
+                } else if (record.rtype == DnsPacket::RECORDTYPE_NSEC) {
                   
-                    char ipv6address[129] = { 0 };
-                    uv_ip6_name (&record->data.aaaa, ipv6address, 128);
-                    time_t expirationTime = time(nullptr)+record->ttl;
+                    LOG->info ("Received RECORD TYPE NSEC ttl: %: % from [% @ %]", 
+                                   record.ttl, record.name, ipaddress, iface);
                     
-                    LOG->info ("Received RECORD TYPE AAAA: % => % [CACHE FLUSH: %] from [% @ %]", record->name, ipv6address, record->cacheFlush, ipaddress, iface);
+                    mdns->cacheNsec (packet, record);
                     
-                    if (record->ttl == 0) { // Remove
-                        mdns->_recordsAAAA.erase (record->name);
-                    } else {            
-                        mdns->_recordsAAAA[record->name] = std::make_pair (expirationTime, std::string(ipv6address));
-                        mdns->printCache();
-                        mdns->notify (DnsPacket::RECORDTYPE_AAAA, record->name, ipv6address);
-                    }                                    
+                } else if (record.rtype == DnsPacket::RECORDTYPE_PTR) {
+                  
+                    LOG->info ("Received RECORD TYPE PTR ttl: %: % => % from [% @ %]", 
+                                   record.ttl, record.name, record.target, ipaddress, iface);
                     
+                    mdns->browseRecord (packet, record);
                     
                 } else {
-                    LOG->info ("Received RECORD TYPE %: name: % - IGNORING IT", record->rtype, record->name);
+                    LOG->info ("Received RECORD TYPE %: name: % - IGNORING IT", record.rtype, record.name);
                 }
             }
         }
     }
+}
+
+void Client::cacheRecord (
+    const DnsPacket::Packet& packet,
+    const DnsPacket::Record& record)
+{
+    //NOTE: the name is hashed once, an existing entry is refreshed in
+    // place and only a new one decodes and copies the name
+    uint64_t hash = DnsPacket::HashName (packet.data, packet.size, record.name.offset);
+    
+    RecordCache::address_t address;
+    if (record.rtype == DnsPacket::RECORDTYPE_A) {
+        address.v4 = record.data.a.sin_addr;
+    } else {
+        address.v6 = record.data.aaaa.sin6_addr;
+    }
+    
+    if (record.ttl == 0) { // Remove
+        auto entry = _cache.find (record.name, hash, record.rtype, address);
+        if (entry != nullptr) {
+            //NOTE: the copy keeps its name alive for the callback, erase
+            // may drop the last reference
+            RecordCache::entry_t gone = *entry;
+            _names.retain (gone.name);
+            _cache.erase (record.name, hash, record.rtype, address);
+            notifyExpired (gone);
+            _names.release (gone.name);
+        }
+        return;
+    }
     
-    free (buf->base);
+    //NOTE: acceptDatagram lets whole packets through, records for names
+    // nobody asked for are dropped here
+    if (!_cacheUnsolicited && _watchedNames.count (hash) == 0) {
+        return;
+    }
+    
+    uint64_t now = uv_now (_loop);
+    
+    if (record.cacheFlush) {
+        _cache.flush (record.name, hash, record.rtype, now);
+    }
+    
+    auto entry = _cache.update (record.name, hash, record.rtype, record.ttl, address, now);
+    if (entry == nullptr) {
+        return;
+    }
+    
+    watchName (hash);
+    startExpiryTimer();
+    
+    if (Logger::getLogLevel() >= Logger::INFO) {
+        LOG->info ("Cached: % => %", _cache.getName (*entry), RecordCache::AddressToString (*entry));
+        printCache();
+    }
+    
+    notify (*entry);
+}
+
+void Client::cacheNsec (
+    const DnsPacket::Packet& packet,
+    const DnsPacket::Record& record)
+{
+    //NOTE: RFC 6762 6.1, types missing from the bitmap do not exist
+    uint64_t hash = DnsPacket::HashName (packet.data, packet.size, record.name.offset);
+    
+    if (_watchedNames.count (hash) == 0) {
+        return;
+    }
+    
+    uint64_t now = uv_now (_loop);
+    
+    for (uint16_t type: { DnsPacket::RECORDTYPE_A, DnsPacket::RECORDTYPE_AAAA }) {
+        if (DnsPacket::NsecHasType (record, type)) {
+            continue;
+        }
+        if (record.ttl == 0) {
+            _cache.eraseNegative (record.name, hash, type);
+        } else {
+            LOG->debug ("Negative: % type: % ttl: %", record.name, type, record.ttl);
+            _cache.addNegative (record.name, hash, type, (uint64_t)record.ttl * 1000, now);
+        }
+    }
+    
+    startExpiryTimer();
+}
+
+bool Client::acceptDatagram (
+    const uint8_t* data,
+    size_t size)
+{
+    //NOTE: header only pre-filter, nothing is decoded or allocated.
+    // Keeps questions for our own name and, in responses, A/AAAA records
+    // we cache or are waiting for and NSEC and PTR records for watched
+    // names.
+    DnsPacket::Scanner scanner (data, size);
+    
+    if (!scanner.valid()) {
+        return false;
+    }
+    
+    bool response = scanner.getFlags() & DnsPacket::FLAG_RESPONSE;
+    
+    while (scanner.next()) {
+        uint16_t type = scanner.getType();
+        bool address = type == DnsPacket::RECORDTYPE_A || type == DnsPacket::RECORDTYPE_AAAA;
+        if (scanner.getSection() == 0) {
+            if (address && scanner.nameEquals (_uuid)) {
+                return true;
+            }
+        } else if (response && (type == DnsPacket::RECORDTYPE_NSEC || 
+                                type == DnsPacket::RECORDTYPE_PTR)) 
+        {
+            //NOTE: only denials for names we asked about and PTR sets of
+            // browsed service types are of use
+            if (_watchedNames.count (scanner.getNameHash()) > 0) {
+                return true;
+            }
+        } else if (response && address) {
+            if (_cacheUnsolicited || 
+                _watchedNames.count (scanner.getNameHash()) > 0) 
+            {
+                return true;
+            }
+        }
+    }
+    
+    return false;
+}
+
+void Client::watchName (
+    uint64_t hash)
+{
+    size_t watched = _cache.size() + _browses.size() +
+                     _recordsACallbacks.size() + _recordsAAAACallbacks.size();
+    
+    if (_watchedNames.size() > 2 * watched + 64) {
+        _watchedNames.clear();
+        _cache.forEach ([&](const RecordCache::entry_t& entry) {
+            _watchedNames.insert (entry.hash);
+        });
+        for (auto& query: _recordsACallbacks) {
+            _watchedNames.insert (_names.hash (query.first));
+        }
+        for (auto& query: _recordsAAAACallbacks) {
+            _watchedNames.insert (_names.hash (query.first));
+        }
+        for (auto& browse: _browses) {
+            _watchedNames.insert (_names.hash (browse.first));
+        }
+    }
+    
+    _watchedNames.insert (hash);
 }
 
 std::shared_ptr<Client> Client::New (
     uv_loop_t* loop, 
-    NetworkInterfaceFilter filter) 
+    NetworkInterfaceFilter filter,
+    const std::string& snapshotPath) 
 {
-    return std::shared_ptr<Client> (new Client(loop, filter));
+    return std::shared_ptr<Client> (new Client(loop, filter, snapshotPath));
 }
 
 Client::Client (
     uv_loop_t* loop, 
-    NetworkInterfaceFilter filter) 
+    NetworkInterfaceFilter filter,
+    const std::string& snapshotPath) :
+    _loop  (loop ? loop : uv_default_loop()),
+    _cache (_names, uv_now (_loop))
 {
   
-    if (loop) {
-        _loop = loop;
-    } else {
-        _loop = uv_default_loop();
-    }
-    
     _uuid = uuids::system_uuid().to_string()+".local";
     
+    _cache.setMaxEntries (DEFAULT_CACHE_MAX_ENTRIES);
+    
     LOG->info ("Created with uuid: %", _uuid);
     
+    memset (&_mdnsGroupIpv4, 0, sizeof(_mdnsGroupIpv4));
+    _mdnsGroupIpv4.sin_family = AF_INET;
+#ifdef __APPLE__
+    _mdnsGroupIpv4.sin_len = sizeof(struct sockaddr_in);
+#endif
+    _mdnsGroupIpv4.sin_addr.s_addr = htonl((((uint32_t)224U) << 24U) | ((uint32_t)251U));
+    _mdnsGroupIpv4.sin_port = htons((unsigned short)5353);
+    
+    memset (&_mdnsGroupIpv6, 0, sizeof(_mdnsGroupIpv6));
+    _mdnsGroupIpv6.sin6_family = AF_INET6;
+#ifdef __APPLE__
+    _mdnsGroupIpv6.sin6_len = sizeof(struct sockaddr_in6);
+#endif
+    _mdnsGroupIpv6.sin6_addr.s6_addr[0] = 0xFF;
+    _mdnsGroupIpv6.sin6_addr.s6_addr[1] = 0x02;
+    _mdnsGroupIpv6.sin6_addr.s6_addr[15] = 0xFB;
+    _mdnsGroupIpv6.sin6_port = htons((unsigned short)5353);
+    
+    _flushQuestionsTimer = new uv_timer_t();
+    uv_timer_init (_loop, _flushQuestionsTimer);
+    _flushQuestionsTimer->data = this;
+    
+    _queryTimer = new uv_timer_t();
+    uv_timer_init (_loop, _queryTimer);
+    _queryTimer->data = this;
+    
+    //NOTE: unreferenced, cached records alone do not keep the loop alive
+    _expiryTimer = new uv_timer_t();
+    uv_timer_init (_loop, _expiryTimer);
+    uv_unref ((uv_handle_t*) _expiryTimer);
+    _expiryTimer->data = this;
+    
+    _publishTimer = new uv_timer_t();
+    uv_timer_init (_loop, _publishTimer);
+    uv_unref ((uv_handle_t*) _publishTimer);
+    _publishTimer->data = this;
+    
+    _publishCheck = new uv_check_t();
+    uv_check_init (_loop, _publishCheck);
+    uv_unref ((uv_handle_t*) _publishCheck);
+    _publishCheck->data = this;
+    uv_check_start (_publishCheck, libuvCheckPublish);
+    
+    if (!snapshotPath.empty()) {
+        loadSnapshot (snapshotPath);
+    }
+    
     auto ifaces = getNetworkInterfaces (filter);
     for (auto &iface: *ifaces) {
     
@@ -198,6 +406,8 @@ Client::Client (
                            iface.ipAddress);
         }        
     }
+    
+    buildResponseTemplates();
 }
 
 Client::~Client() {
@@ -207,6 +417,31 @@ Client::~Client() {
     // Send TTL 0 for A record.
     announceA (0);
     
+    uv_timer_stop (_flushQuestionsTimer);
+    uv_close ((uv_handle_t*) _flushQuestionsTimer, [](uv_handle_t* handle) {
+        delete handle;
+    });
+    
+    uv_timer_stop (_queryTimer);
+    uv_close ((uv_handle_t*) _queryTimer, [](uv_handle_t* handle) {
+        delete handle;
+    });
+    
+    uv_timer_stop (_expiryTimer);
+    uv_close ((uv_handle_t*) _expiryTimer, [](uv_handle_t* handle) {
+        delete handle;
+    });
+    
+    uv_timer_stop (_publishTimer);
+    uv_close ((uv_handle_t*) _publishTimer, [](uv_handle_t* handle) {
+        delete handle;
+    });
+    
+    uv_check_stop (_publishCheck);
+    uv_close ((uv_handle_t*) _publishCheck, [](uv_handle_t* handle) {
+        delete handle;
+    });
+    
     for (auto &uv_udp: _udpHandleToInterface) {
       
         if (uv_udp_recv_stop (uv_udp.first) != 0) {
@@ -222,43 +457,181 @@ Client::~Client() {
 }
 
 void Client::notify (
-    DnsPacket::record_type_t type, 
-    const std::string& name, 
-    const std::string& ipv4) 
+    const RecordCache::entry_t& entry) 
 {
   
-    LOG->debug ("notify type: %", type);
-    auto selfReference = shared_from_this();
+    LOG->debug ("notify type: %", entry.type);
     
-    recordCallbacks_t& callbacks = _recordsACallbacks;
+    recordCallbacks_t& callbacks = (entry.type == DnsPacket::RECORDTYPE_AAAA) ?
+        _recordsAAAACallbacks : _recordsACallbacks;
     
-    if (type == DnsPacket::RECORDTYPE_A) {
-        callbacks = _recordsACallbacks;
-    } else if (type == DnsPacket::RECORDTYPE_AAAA) {
-        callbacks = _recordsAAAACallbacks;
+    if (callbacks.empty()) {
+        return;
     }
     
-    auto it = callbacks.find (name);
+    auto it = callbacks.find (entry.name);
     if (it != callbacks.end()) {
       
-        auto itQueries = it->second.begin();
-        
-        while (itQueries != it->second.end()) {
-            auto queryHandler = *itQueries;          
-            // Remove the timer                    
-            uv_timer_stop (queryHandler->uvTimerHandler.get());
-            auto uvTimerHandler = queryHandler->uvTimerHandler.release();
-            uv_close ((uv_handle_t *)uvTimerHandler, [](uv_handle_t* handle) {
-                delete handle;
-            });
-            
-            if (!queryHandler->callbackWeak.expired()) {
-                (*queryHandler->callbackWeak.lock()) (false, name, ipv4);
+        auto selfReference = shared_from_this();
+        
+        //NOTE: someone is waiting for it, keep it refreshed
+        _cache.touch (_cache.getName (entry), entry.type, uv_now (_loop));
+        
+        //NOTE: copies, callbacks may change the cache
+        std::string name    = _cache.getName (entry);
+        std::string address = RecordCache::AddressToString (entry);
+        
+        //NOTE: out of the map first, a callback querying the same name
+        // again starts a new query. Its deadline is left in the heap, it
+        // no longer matches a query
+        auto queryHandler = it->second;
+        callbacks.erase (it);
+        startQueryTimer();
+        
+        for (auto& callbackWeak: queryHandler->callbacks) {
+            if (!callbackWeak.expired()) {
+                (*callbackWeak.lock()) (false, name, address);
             }
-            itQueries++;
         }
-        callbacks.erase (it);
+        _names.release (queryHandler->name);
+    }
+}
+
+void Client::notifyExpired (
+    const RecordCache::entry_t& entry)
+{
+  
+    LOG->info ("Expired: % type: %", _cache.getName (entry), entry.type);
+    
+    if (_expiryCallbackWeak.expired()) {
+        return;
+    }
+    
+    auto selfReference = shared_from_this();
+    (*_expiryCallbackWeak.lock()) (_cache.getName (entry), RecordCache::AddressToString (entry));
+}
+
+void Client::setExpiryCallback (
+    std::shared_ptr<CallbackExpired> callback)
+{
+    _expiryCallbackWeak = callback;
+}
+
+void Client::startExpiryTimer ()
+{
+  
+    uint64_t now = uv_now (_loop);
+    int64_t timeout = _cache.nextTimeout (now);
+    
+    if (timeout < 0) {
+        uv_timer_stop (_expiryTimer);
+        return;
+    }
+    
+    //NOTE: only moved earlier, a timer firing early just rearms itself
+    if (!uv_is_active ((uv_handle_t*) _expiryTimer) || now + timeout < _expiryTimerDue) {
+        _expiryTimerDue = now + timeout;
+        uv_timer_start (_expiryTimer, libuvExpireRecords, timeout, 0);
+    }
+}
+
+void Client::loadSnapshot (
+    const std::string& path)
+{
+  
+    _snapshot = CacheSnapshot::Open (path);
+    if (_snapshot == nullptr) {
+        LOG->error ("Cannot open cache snapshot: %", path);
+        return;
+    }
+    
+    //NOTE: restored records get new slab slots, the snapshot is
+    // rewritten from the cache as they are inserted
+    auto records = _snapshot->load();
+    _snapshot->clear();
+    _cache.setSnapshot (_snapshot.get());
+    
+    uint64_t now = uv_now (_loop);
+    for (auto& record: records) {
+        auto entry = _cache.restore (record.name, record.type, record.ttl, record.address, record.remaining, now);
+        watchName (entry->hash);
     }
+    
+    LOG->info ("Restored % records from: %", records.size(), path);
+    
+    startExpiryTimer();
+}
+
+void Client::libuvExpireRecords (
+    uv_timer_t* handle)
+{
+  
+    auto mdns = (Client*) handle->data;
+    auto selfReference = mdns->shared_from_this();
+    
+    mdns->_cache.expire (uv_now (mdns->_loop), [&](const RecordCache::entry_t& entry) {
+        mdns->notifyExpired (entry);
+    }, [&](const RecordCache::entry_t& entry) {
+        //NOTE: refreshes due together share the coalescing window
+        LOG->debug ("Refresh: % type: %", mdns->_cache.getName (entry), entry.type);
+        mdns->enqueueQuestion (mdns->_cache.getName (entry), (DnsPacket::record_type_t) entry.type);
+    });
+    
+    mdns->startExpiryTimer();
+}
+
+void Client::libuvCheckPublish (
+    uv_check_t* handle)
+{
+    //NOTE: runs after every loop iteration, a burst of records is
+    // published once
+    auto mdns = (Client*) handle->data;
+    
+    if (mdns->_cache.version() != mdns->_publishedVersion &&
+        !uv_is_active ((uv_handle_t*) mdns->_publishTimer))
+    {
+        uv_timer_start (mdns->_publishTimer, libuvPublishView, VIEW_PUBLISH_DELAY, 0);
+    }
+}
+
+void Client::libuvPublishView (
+    uv_timer_t* handle)
+{
+  
+    auto mdns = (Client*) handle->data;
+    
+    uint64_t version = mdns->_cache.version();
+    if (!mdns->_view.publish (mdns->_cache, uv_now (mdns->_loop))) {
+        //NOTE: a reader still holds the table before the current one
+        uv_timer_start (mdns->_publishTimer, libuvPublishView, VIEW_PUBLISH_DELAY, 0);
+        return;
+    }
+    mdns->_publishedVersion = version;
+}
+
+bool Client::lookupCached (
+    const std::string& name,
+    DnsPacket::record_type_t type,
+    std::string& ipAddress) const
+{
+  
+    RecordCache::address_t address;
+    if (!_view.lookup (name, type, address)) {
+        return false;
+    }
+    
+    char buffer[INET6_ADDRSTRLEN];
+    int family = type == DnsPacket::RECORDTYPE_AAAA ? AF_INET6 : AF_INET;
+    if (uv_inet_ntop (family, &address, buffer, sizeof(buffer)) != 0) {
+        return false;
+    }
+    ipAddress = buffer;
+    return true;
+}
+
+std::vector<CacheView::record_t> Client::getCachedRecords () const
+{
+    return _view.records();
 }
 
 std::string Client::getLocalDomain() 
@@ -266,37 +639,144 @@ std::string Client::getLocalDomain()
     return _uuid;
 }
 
-void Client::libuvTimeoutHandlerForQueries (
+void Client::libuvQueryEvents (
     uv_timer_t* handle) 
 {
 
-    auto queryHandler = (queryHandler_t*) handle->data;
-    
-    LOG->debug ("libuvTimeoutHandlerForQueries name: %", queryHandler->name);
+    auto mdns = (Client*) handle->data;
+    auto selfReference = mdns->shared_from_this();
     
-    auto mdns = queryHandler->mdns;
+    uint64_t now = uv_now (mdns->_loop);
+    auto& events = mdns->_queryEvents;
     
-    auto selfReference = mdns->shared_from_this();
+    while (!events.empty() && events.front().when <= now) {
         
-    auto uvTimerHandler = queryHandler->uvTimerHandler.release();
-    uv_close ((uv_handle_t *)uvTimerHandler, [](uv_handle_t* handle) {
-        delete handle;
-    });
+        queryEvent_t event = events.front();
+        std::pop_heap (events.begin(), events.end(), QueryEventLater());
+        events.pop_back();
+        
+        if (event.type == RESOLUTION_DELAY_EVENT) {
+            auto it = mdns->_resolves.find (event.name);
+            if (it != mdns->_resolves.end() && it->second->delayUntil == event.when) {
+                mdns->finishResolve (event.name, false, it->second->addressA);
+            }
+            continue;
+        }
+        
+        if (event.type == DnsPacket::RECORDTYPE_PTR) {
+            auto it = mdns->_browses.find (event.name);
+            if (it != mdns->_browses.end() && it->second->due == event.when) {
+                mdns->runBrowse (it->second, now);
+            }
+            continue;
+        }
+        
+        //NOTE: answered queries and moved deadlines leave stale entries
+        recordCallbacks_t& callbacks = (event.type == DnsPacket::RECORDTYPE_AAAA) ?
+            mdns->_recordsAAAACallbacks : mdns->_recordsACallbacks;
+        auto it = callbacks.find (event.name);
+        if (it == callbacks.end()) {
+            continue;
+        }
+        
+        if (it->second->retransmit == event.when) {
+            LOG->debug ("retransmit: % type: %", mdns->_names.name (event.name), event.type);
+            mdns->enqueueQuestion (mdns->_names.name (event.name), (DnsPacket::record_type_t) event.type);
+            mdns->scheduleRetransmit (*it->second, now);
+            continue;
+        }
+        
+        if (it->second->deadline != event.when) {
+            continue;
+        }
+        
+        //NOTE: the map owns the query, keep it while its callbacks run
+        auto queryHandler = it->second;
+        callbacks.erase (it);
+        mdns->timeoutQuery (*queryHandler);
+    }
     
-    if (!queryHandler->callbackWeak.expired()) {
-        (*queryHandler->callbackWeak.lock()) (true, queryHandler->name, "");
+    mdns->startQueryTimer();
+}
+
+void Client::timeoutQuery (
+    const queryHandler_t& queryHandler)
+{
+  
+    //NOTE: a copy, the table can grow from the callbacks
+    std::string name = _names.name (queryHandler.name);
+    
+    LOG->debug ("timeoutQuery name: %", name);
+    
+    //NOTE: before the callbacks, a retry from them fails at once
+    if (_negativeHoldDown > 0) {
+        _cache.addNegative (name, queryHandler.type, _negativeHoldDown, uv_now (_loop));
+        startExpiryTimer();
+    }
+    
+    for (auto& callbackWeak: queryHandler.callbacks) {
+        if (!callbackWeak.expired()) {
+            (*callbackWeak.lock()) (true, name, "");
+        }
+    }
+    _names.release (queryHandler.name);
+}
+
+void Client::scheduleEvent (
+    NameTable::id_t name,
+    uint16_t type,
+    uint64_t when)
+{
+    queryEvent_t event;
+    event.when = when;
+    event.name = name;
+    event.type = type;
+    _queryEvents.push_back (event);
+    std::push_heap (_queryEvents.begin(), _queryEvents.end(), QueryEventLater());
+    
+    startQueryTimer();
+}
+
+void Client::scheduleRetransmit (
+    queryHandler_t& queryHandler,
+    uint64_t now)
+{
+    //NOTE: RFC 6762 5.2, the interval doubles after every retransmission
+    queryHandler.retransmit = 0;
+    if (queryHandler.interval == 0) {
+        return;
+    }
+    uint64_t when = now + queryHandler.interval;
+    if (when >= queryHandler.deadline) {
+        return;
+    }
+    queryHandler.retransmit = when;
+    queryHandler.interval *= 2;
+    scheduleEvent (queryHandler.name, queryHandler.type, when);
+}
+
+void Client::startQueryTimer ()
+{
+  
+    //NOTE: only stale entries left
+    if (_recordsACallbacks.empty() && _recordsAAAACallbacks.empty() && 
+        _resolves.empty() && _browses.empty()) 
+    {
+        _queryEvents.clear();
     }
     
-    auto it = mdns->_recordsACallbacks.find (queryHandler->name);
-    if (it != mdns->_recordsACallbacks.end()) {
-        auto list = it->second;        
-        std::remove_if (std::begin (list),
-                        std::end   (list),
-                        [&]( std::shared_ptr<queryHandler_t> q ){ return queryHandler == q.get(); } );
+    if (_queryEvents.empty()) {
+        uv_timer_stop (_queryTimer);
+        return;
     }
     
-    LOG->debug ("libuvTimeoutHandlerForQueries END");
+    uint64_t now = uv_now (_loop);
+    uint64_t next = _queryEvents.front().when;
     
+    if (!uv_is_active ((uv_handle_t*) _queryTimer) || next < _queryTimerDue) {
+        _queryTimerDue = next;
+        uv_timer_start (_queryTimer, libuvQueryEvents, next > now ? next - now : 0, 0);
+    }
 }
 
 void Client::queryA (
@@ -305,42 +785,655 @@ void Client::queryA (
     callback, 
     uint32_t timeoutMsecs) 
 {
-    LOG->info ("query TYPE_A to: %", name);
+    query (name, DnsPacket::RECORDTYPE_A, callback, timeoutMsecs, false);
+}
+
+void Client::queryAAAA (
+    const std::string& name, 
+    std::shared_ptr<CallbackA> callback, 
+    uint32_t timeoutMsecs) 
+{
+    query (name, DnsPacket::RECORDTYPE_AAAA, callback, timeoutMsecs, false);
+}
+
+void Client::query (
+    const std::string& name, 
+    DnsPacket::record_type_t type,
+    std::shared_ptr<CallbackA> callback, 
+    uint32_t timeoutMsecs,
+    bool defer) 
+{
+    LOG->info ("query type: % to: %", type, name);
     
     //First check cache and TTL
-    auto it = _recordsA.find(name);
-    if (it != _recordsA.end()) {
-        // Check ttl
-        time_t expirationTime = it->second.first;
-        if (expirationTime < time(nullptr)) {
-            return (*callback) (false, name, it->second.second);
-        } else {
-            _recordsA.erase(it);
-        }
+    if (_cache.isNegative (name, type, uv_now (_loop))) {
+        LOG->info ("query type: % to: % known not to exist", type, name);
+        return (*callback) (true, name, "");
+    }
+    
+    auto entry = _cache.lookup (name, type, uv_now (_loop));
+    if (entry != nullptr) {
+        return (*callback) (false, name, RecordCache::AddressToString (*entry));
     }
     
     // Not found or expired do query
   
-    std::weak_ptr<CallbackA> callbackWeak = callback;            
-    auto queryHandler = std::make_shared<queryHandler_t>();
-    queryHandler->mdns = this;
-    queryHandler->callbackWeak = callbackWeak;            
-    queryHandler->name = name;
-    queryHandler->timeoutMsecs = timeoutMsecs;
-    
-    _recordsACallbacks[name].push_back (queryHandler);
+    uint64_t now = uv_now (_loop);
+    uint64_t deadline = now + timeoutMsecs;
+    
+    recordCallbacks_t& callbacks = (type == DnsPacket::RECORDTYPE_AAAA) ?
+        _recordsAAAACallbacks : _recordsACallbacks;
+    
+    //NOTE: the query holds a reference to its name
+    NameTable::id_t id = _names.intern (name);
+    auto& queryHandler = callbacks[id];
+    
+    //NOTE: already in flight, share its packet and its deadline. The
+    // deadline is only moved later, no caller waits less than it asked
+    if (queryHandler != nullptr) {
+        _names.release (id);
+        queryHandler->callbacks.push_back (callback);
+        if (deadline > queryHandler->deadline) {
+            queryHandler->deadline = deadline;
+            scheduleEvent (queryHandler->name, queryHandler->type, deadline);
+            //NOTE: the schedule may have run out before the old deadline
+            if (queryHandler->retransmit == 0) {
+                scheduleRetransmit (*queryHandler, now);
+            }
+        }
+        LOG->debug ("query type: % to: % already in flight, % waiting", type, name, queryHandler->callbacks.size());
+        return;
+    }
+    
+    queryHandler = std::make_shared<queryHandler_t>();
+    queryHandler->name = id;
+    queryHandler->type = type;
+    queryHandler->deadline = deadline;
+    queryHandler->interval = _queryRetransmitInterval;
+    queryHandler->callbacks.push_back (callback);
+    watchName (_names.hash (id));
  
-    auto packet = DnsPacket::NewQueryA (queryHandler->name);
+    enqueueQuestion (name, type, defer);
+    scheduleEvent (queryHandler->name, queryHandler->type, deadline);
+    scheduleRetransmit (*queryHandler, now);
+    
+}
+
+void Client::resolve (
+    const std::string& name, 
+    std::shared_ptr<CallbackA> callback, 
+    uint32_t timeoutMsecs) 
+{
+    LOG->info ("resolve: %", name);
     
-    for (auto &uv_udp: queryHandler->mdns->_udpHandleToInterface) {
-        sendPacket (uv_udp.first, packet);        
+    //NOTE: the resolve holds a reference to its name
+    NameTable::id_t id = _names.intern (name);
+    auto it = _resolves.find (id);
+    if (it != _resolves.end()) {
+        _names.release (id);
+        it->second->callbacks.push_back (callback);
+        return;
     }
     
-    // Set timeout    
-    uv_timer_init (_loop, queryHandler->uvTimerHandler.get());
-    queryHandler->uvTimerHandler->data = queryHandler.get();
-    uv_timer_start (queryHandler->uvTimerHandler.get(), libuvTimeoutHandlerForQueries, queryHandler->timeoutMsecs, 0);
+    auto resolveHandler = std::make_shared<resolve_t>();
+    resolveHandler->name = id;
+    resolveHandler->callbacks.push_back (callback);
+    resolveHandler->callbackAAAA = std::make_shared<CallbackA> ([this, id](bool error, const std::string& name, const std::string& ipAddress) {
+        resolveAnswer (id, DnsPacket::RECORDTYPE_AAAA, error, ipAddress);
+    });
+    resolveHandler->callbackA = std::make_shared<CallbackA> ([this, id](bool error, const std::string& name, const std::string& ipAddress) {
+        resolveAnswer (id, DnsPacket::RECORDTYPE_A, error, ipAddress);
+    });
+    
+    //NOTE: registered before querying, the cache may answer at once.
+    // Deferred, both questions go out in one packet
+    _resolves[id] = resolveHandler;
+    auto selfReference = shared_from_this();
+    query (name, DnsPacket::RECORDTYPE_AAAA, resolveHandler->callbackAAAA, timeoutMsecs, true);
+    if (_resolves.count (id) > 0) {
+        query (name, DnsPacket::RECORDTYPE_A, resolveHandler->callbackA, timeoutMsecs, true);
+    }
+    if (_queryCoalescingWindow == 0) {
+        flushQuestions();
+    }
+}
+
+void Client::resolveAnswer (
+    NameTable::id_t id,
+    DnsPacket::record_type_t type,
+    bool error,
+    const std::string& ipAddress)
+{
+    auto it = _resolves.find (id);
+    if (it == _resolves.end()) {
+        return;
+    }
+    resolve_t& resolve = *it->second;
+    
+    if (type == DnsPacket::RECORDTYPE_AAAA) {
+        resolve.failedAAAA = error;
+        if (!error) {
+            finishResolve (id, false, ipAddress);
+        } else if (!resolve.addressA.empty()) {
+            finishResolve (id, false, resolve.addressA);
+        } else if (resolve.failedA) {
+            finishResolve (id, true, "");
+        }
+        return;
+    }
+    
+    resolve.failedA = error;
+    if (error) {
+        if (resolve.failedAAAA) {
+            finishResolve (id, true, "");
+        }
+    } else if (resolve.failedAAAA) {
+        finishResolve (id, false, ipAddress);
+    } else {
+        //NOTE: RFC 8305 3, give AAAA a short head start before using A
+        resolve.addressA = ipAddress;
+        resolve.delayUntil = uv_now (_loop) + RESOLUTION_DELAY;
+        scheduleEvent (id, RESOLUTION_DELAY_EVENT, resolve.delayUntil);
+    }
+}
+
+void Client::finishResolve (
+    NameTable::id_t id,
+    bool error,
+    const std::string& ipAddress)
+{
+    auto it = _resolves.find (id);
+    
+    //NOTE: out of the map first, the query still running for the other
+    // family holds its callback weakly and is ignored from now on
+    auto resolve = it->second;
+    _resolves.erase (it);
+    
+    //NOTE: copies, the table can grow from the callbacks
+    std::string name    = _names.name (id);
+    std::string address = ipAddress;
+    
+    LOG->debug ("resolve: % => %", name, address);
     
+    for (auto& callbackWeak: resolve->callbacks) {
+        if (!callbackWeak.expired()) {
+            (*callbackWeak.lock()) (error, name, address);
+        }
+    }
+    _names.release (id);
+}
+
+void Client::browse (
+    const std::string& serviceType,
+    std::shared_ptr<CallbackBrowse> callback)
+{
+    LOG->info ("browse: %", serviceType);
+    
+    //NOTE: the browse holds a reference to its name
+    NameTable::id_t id = _names.intern (serviceType);
+    auto& browse = _browses[id];
+    
+    if (browse != nullptr) {
+        _names.release (id);
+        browse->callbacks.push_back (callback);
+        //NOTE: the new caller starts from the instances already known.
+        // Copies, the callback may stop the browse
+        auto running = browse;
+        std::vector<std::string> instances;
+        for (auto& instance: running->instances) {
+            instances.push_back (_names.name (instance.first));
+        }
+        for (auto& instance: instances) {
+            if (!isBrowsing (*running)) {
+                break;
+            }
+            (*callback) (true, serviceType, instance);
+        }
+        return;
+    }
+    
+    uint64_t now = uv_now (_loop);
+    
+    //NOTE: RFC 6762 5.2, at least one second between the first two
+    // queries, then the interval doubles
+    browse = std::make_shared<browse_t>();
+    browse->name = id;
+    browse->callbacks.push_back (callback);
+    browse->nextQuery = now + BROWSE_FIRST_INTERVAL;
+    browse->interval = 2 * BROWSE_FIRST_INTERVAL;
+    browse->due = 0;
+    watchName (_names.hash (id));
+    
+    scheduleBrowse (*browse, browse->nextQuery);
+    enqueueQuestion (serviceType, DnsPacket::RECORDTYPE_PTR);
+}
+
+void Client::stopBrowse (
+    const std::string& serviceType)
+{
+    auto it = _browses.find (_names.find (serviceType));
+    if (it == _browses.end()) {
+        return;
+    }
+    
+    LOG->info ("stopBrowse: %", serviceType);
+    
+    //NOTE: its event is left in the heap, it no longer matches a browse
+    auto browse = it->second;
+    _browses.erase (it);
+    for (auto& instance: browse->instances) {
+        _names.release (instance.first);
+    }
+    browse->instances.clear();
+    _names.release (browse->name);
+    startQueryTimer();
+}
+
+void Client::browseRecord (
+    const DnsPacket::Packet& packet,
+    const DnsPacket::Record& record)
+{
+    if (_browses.empty()) {
+        return;
+    }
+    
+    //NOTE: only the owner is hashed for records nobody browses
+    uint64_t hash = DnsPacket::HashName (packet.data, packet.size, record.name.offset);
+    auto it = _browses.find (_names.find (record.name, hash));
+    if (it == _browses.end()) {
+        return;
+    }
+    auto browse = it->second;
+    
+    uint64_t targetHash = DnsPacket::HashName (packet.data, packet.size, record.target.offset);
+    if (targetHash == 0) {
+        return;
+    }
+    
+    uint64_t now = uv_now (_loop);
+    
+    if (record.ttl == 0) {
+        //NOTE: goodbye, removed by the browse event
+        auto instance = browse->instances.find (_names.find (record.target, targetHash));
+        if (instance != browse->instances.end()) {
+            instance->second.expiration = std::min (instance->second.expiration, now + GOODBYE_DELAY);
+            instance->second.refresh = 0;
+            scheduleBrowse (*browse, instance->second.expiration);
+        }
+        return;
+    }
+    
+    NameTable::id_t id = _names.intern (record.target, targetHash);
+    if (id == NameTable::INVALID_ID) {
+        return;
+    }
+    
+    auto result = browse->instances.emplace (id, browseInstance_t());
+    auto& instance = result.first->second;
+    instance.ttl = record.ttl;
+    instance.received = now;
+    instance.expiration = now + (uint64_t)record.ttl * 1000;
+    //NOTE: asked again at the refresh points of cached records
+    instance.refreshes = 0;
+    instance.refresh = RecordCache::RefreshPoint (now, record.ttl, 0);
+    scheduleBrowse (*browse, instance.refresh);
+    
+    if (!result.second) {
+        _names.release (id);
+        return;
+    }
+    
+    //NOTE: copies, the table can grow from the callbacks
+    std::string serviceType = _names.name (browse->name);
+    std::string name        = _names.name (id);
+    notifyBrowse (*browse, true, serviceType, name);
+}
+
+void Client::scheduleBrowse (
+    browse_t& browse,
+    uint64_t when)
+{
+    //NOTE: only ever moved earlier here, a later one is picked up by
+    // runBrowse when the earlier one is reached
+    if (browse.due == 0 || when < browse.due) {
+        browse.due = when;
+        scheduleEvent (browse.name, DnsPacket::RECORDTYPE_PTR, when);
+    }
+}
+
+void Client::runBrowse (
+    std::shared_ptr<browse_t> browse,
+    uint64_t now)
+{
+    browse->callbacks.remove_if ([](const std::weak_ptr<CallbackBrowse>& callback) {
+        return callback.expired();
+    });
+    
+    //NOTE: copies, the table can grow from the callbacks
+    std::string serviceType = _names.name (browse->name);
+    
+    if (browse->callbacks.empty()) {
+        stopBrowse (serviceType);
+        return;
+    }
+    
+    bool query = browse->nextQuery <= now;
+    if (query) {
+        browse->nextQuery = now + browse->interval;
+        browse->interval = 2 * browse->interval < BROWSE_MAX_INTERVAL ? 
+            2 * browse->interval : BROWSE_MAX_INTERVAL;
+    }
+    
+    std::vector<NameTable::id_t> gone;
+    uint64_t due = browse->nextQuery;
+    
+    for (auto it = browse->instances.begin(); it != browse->instances.end();) {
+        auto& instance = it->second;
+        if (instance.expiration <= now) {
+            gone.push_back (it->first);
+            it = browse->instances.erase (it);
+            continue;
+        }
+        if (instance.refresh != 0 && instance.refresh <= now) {
+            //NOTE: the next point retries if this query or its answer
+            // is lost, points missed while the loop was busy are skipped
+            query = true;
+            do {
+                instance.refreshes++;
+                instance.refresh = RecordCache::RefreshPoint (instance.received, instance.ttl, instance.refreshes);
+            } while (instance.refresh != 0 && instance.refresh <= now);
+            if (instance.refresh >= instance.expiration) {
+                instance.refresh = 0;
+            }
+        }
+        due = std::min (due, instance.expiration);
+        if (instance.refresh != 0) {
+            due = std::min (due, instance.refresh);
+        }
+        ++it;
+    }
+    
+    browse->due = 0;
+    scheduleBrowse (*browse, due);
+    
+    if (query) {
+        LOG->debug ("browse query: %", serviceType);
+        enqueueQuestion (serviceType, DnsPacket::RECORDTYPE_PTR);
+    }
+    
+    //NOTE: a callback may stop the browse or drop its last callback,
+    // nothing more is reported then
+    for (auto id: gone) {
+        if (isBrowsing (*browse)) {
+            std::string name = _names.name (id);
+            notifyBrowse (*browse, false, serviceType, name);
+        }
+        _names.release (id);
+    }
+}
+
+bool Client::isBrowsing (
+    const browse_t& browse) const
+{
+    auto it = _browses.find (browse.name);
+    if (it == _browses.end() || it->second.get() != &browse) {
+        return false;
+    }
+    for (auto& callbackWeak: browse.callbacks) {
+        if (!callbackWeak.expired()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Client::notifyBrowse (
+    browse_t& browse,
+    bool added,
+    const std::string& serviceType,
+    const std::string& instance)
+{
+    LOG->info ("browse: % % %", serviceType, added ? "added" : "removed", instance);
+    
+    auto selfReference = shared_from_this();
+    
+    for (auto& callbackWeak: browse.callbacks) {
+        if (!callbackWeak.expired()) {
+            (*callbackWeak.lock()) (added, serviceType, instance);
+        }
+    }
+}
+
+bool Client::tryLookup (
+    const std::string& name,
+    DnsPacket::record_type_t type,
+    RecordCache::address_t& address)
+{
+    auto entry = _cache.lookup (name, type, uv_now (_loop));
+    if (entry == nullptr) {
+        return false;
+    }
+    memcpy (&address, &entry->address, RecordCache::AddressLength (type));
+    return true;
+}
+
+void Client::setCacheMaxEntries (
+    size_t maxEntries)
+{
+    _cache.setMaxEntries (maxEntries);
+}
+
+void Client::setNegativeHoldDown (
+    uint32_t msecs)
+{
+    _negativeHoldDown = msecs;
+}
+
+void Client::setCacheUnsolicited (
+    bool cacheUnsolicited)
+{
+    _cacheUnsolicited = cacheUnsolicited;
+}
+
+RecordCache::stats_t Client::getCacheStats () const
+{
+    return _cache.getStats();
+}
+
+void Client::setQueryCoalescingWindow (
+    uint32_t msecs)
+{
+    _queryCoalescingWindow = msecs;
+}
+
+void Client::setQueryRetransmitInterval (
+    uint32_t msecs)
+{
+    _queryRetransmitInterval = msecs;
+}
+
+void Client::enqueueQuestion (
+    const std::string& name,
+    DnsPacket::record_type_t type,
+    bool defer)
+{
+    for (auto& question: _pendingQuestions) {
+        if (question.second == type && 
+            question.first.size() == name.size() &&
+            DnsPacket::EqualsIgnoreCase (question.first.data(), name.data(), name.size())) 
+        {
+            return;
+        }
+    }
+    
+    _pendingQuestions.emplace_back (name, type);
+    
+    if (_queryCoalescingWindow == 0) {
+        if (!defer) {
+            flushQuestions();
+        }
+    } else if (!uv_is_active ((uv_handle_t*) _flushQuestionsTimer)) {
+        uv_timer_start (_flushQuestionsTimer, libuvFlushQuestions, _queryCoalescingWindow, 0);
+    }
+}
+
+void Client::libuvFlushQuestions (
+    uv_timer_t* handle)
+{
+    auto mdns = (Client*) handle->data;
+    auto selfReference = mdns->shared_from_this();
+    mdns->flushQuestions();
+}
+
+void Client::flushQuestions () 
+{
+  
+    uv_timer_stop (_flushQuestionsTimer);
+    
+    if (_pendingQuestions.empty()) {
+        return;
+    }
+    
+    LOG->debug ("flushQuestions: % questions", _pendingQuestions.size());
+    
+    std::vector<std::shared_ptr<std::vector<uint8_t>>> packets;
+    std::vector<const RecordCache::entry_t*> answers;
+    uint64_t now = uv_now (_loop);
+    size_t next = 0;
+    
+    while (next < _pendingQuestions.size()) {
+      
+        std::unique_ptr<DnsPacket::Encoder> current (new DnsPacket::Encoder (0x0000U, QUERY_PACKET_SIZE));
+        size_t first = next;
+        
+        while (next < _pendingQuestions.size() && 
+               current->addQuestion (_pendingQuestions[next].first, 
+                                    _pendingQuestions[next].second)) 
+        {
+            next++;
+        }
+        if (next == first) {
+            LOG->error ("flushQuestions: question does not fit in a packet: %", 
+                        _pendingQuestions[next].first);
+            next++;
+            continue;
+        }
+        
+        //NOTE: Known-Answer Suppression (RFC 6762 7.1)
+        answers.clear();
+        for (size_t i = first; i < next; i++) {
+            addKnownAnswers (_pendingQuestions[i].first, 
+                             _pendingQuestions[i].second, 
+                             answers);
+        }
+        
+        //NOTE: answers that do not fit go in follow-up packets, the
+        // previous one is marked as truncated (RFC 6762 7.2)
+        auto addAnswer = [&](auto add) {
+            if (add (*current)) {
+                return;
+            }
+            current->setTruncated();
+            packets.push_back (current->getPacket());
+            current.reset (new DnsPacket::Encoder (0x0000U, QUERY_PACKET_SIZE));
+            add (*current);
+        };
+        
+        for (auto entry: answers) {
+            uint32_t remaining = (entry->expiration - now) / 1000;
+            addAnswer ([&](DnsPacket::Encoder& encoder) {
+                return encoder.addRecord (DnsPacket::ENTRYTYPE_ANSWER, _cache.getName (*entry), entry->type, false, remaining, 
+                                          &entry->address, RecordCache::AddressLength (entry->type));
+            });
+        }
+        
+        //NOTE: instances a browse already knows, same half TTL rule
+        for (size_t i = first; i < next; i++) {
+            auto& question = _pendingQuestions[i];
+            if (question.second != DnsPacket::RECORDTYPE_PTR) {
+                continue;
+            }
+            auto browse = _browses.find (_names.find (question.first));
+            if (browse == _browses.end()) {
+                continue;
+            }
+            for (auto& instance: browse->second->instances) {
+                uint64_t expiration = instance.second.expiration;
+                if (expiration <= now || 
+                    (expiration - now) * 2 <= (uint64_t)instance.second.ttl * 1000) 
+                {
+                    continue;
+                }
+                uint32_t remaining = (expiration - now) / 1000;
+                addAnswer ([&](DnsPacket::Encoder& encoder) {
+                    return encoder.addRecordPTR (DnsPacket::ENTRYTYPE_ANSWER, question.first, remaining, 
+                                                 _names.name (instance.first));
+                });
+            }
+        }
+        packets.push_back (current->getPacket());
+    }
+    _pendingQuestions.clear();
+    
+    for (auto& packet: packets) {
+        for (auto &uv_udp: _udpHandleToInterface) {
+            sendPacket (uv_udp.first, packet);        
+        }
+    }
+}
+
+bool Client::isKnownAnswer (
+    const DnsPacket::Packet& packet,
+    const std::map<uv_udp_t*, responseTemplate_t>& templates,
+    uv_udp_t* handleFrom,
+    uint16_t type)
+{
+    auto it = templates.find (handleFrom);
+    if (it == templates.end()) {
+        return false;
+    }
+    
+    //NOTE: the address we would send on this interface, the rdata
+    // follows the TTL and the data length in the template
+    size_t length = type == DnsPacket::RECORDTYPE_A ? 4 : 16;
+    const uint8_t* address = it->second.packet->data() + it->second.ttlOffset + 6;
+    
+    //NOTE: RFC 6762 7.1, only our own record with at least half of our
+    // TTL left means the querier already has it
+    for (auto& record: packet.records) {
+        if (record.rtype != type || 
+            record.length != length ||
+            record.ttl < (uint32_t)DEFAULT_TTL / 2 ||
+            !record.name.equals (_uuid)) 
+        {
+            continue;
+        }
+        const void* known = type == DnsPacket::RECORDTYPE_A ? 
+            (const void*)&record.data.a.sin_addr : (const void*)&record.data.aaaa.sin6_addr;
+        if (memcmp (known, address, length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Client::addKnownAnswers (
+    const std::string& name,
+    uint16_t type,
+    std::vector<const RecordCache::entry_t*>& answers)
+{
+  
+    uint64_t now = uv_now (_loop);
+    
+    //NOTE: records with less than half of their TTL left are not
+    // included, responders should refresh them
+    _cache.forEachRecord (name, type, [&](const RecordCache::entry_t& entry) {
+        if (entry.expiration > now && 
+            (entry.expiration - now) * 2 > (uint64_t)entry.ttl * 1000) 
+        {
+            answers.push_back (&entry);
+        }
+    });
 }
 
 std::shared_ptr<std::list<Client::networkInterface_t>> Client::getNetworkInterfaces (
@@ -531,40 +1624,15 @@ int Client::sendPacket (
     std::shared_ptr<std::vector<uint8_t>> packet) 
 {
   
-    struct sockaddr_storage addr_storage;
-    struct sockaddr_in addr;
-    struct sockaddr_in6 addr6;
-    struct sockaddr* saddr = (struct sockaddr*)&addr_storage;
-    int saddrlen = sizeof(struct sockaddr_storage);
-    
-    if (uv_udp_getsockname (uv_udp, saddr, &saddrlen) != 0) {
-        LOG->error ("sendPacket: error on uv_udp_getsockname");
+    auto itIface = _udpHandleToInterface.find (uv_udp);
+    if (itIface == _udpHandleToInterface.end()) {
+        LOG->error ("sendPacket: unknown udp handle");
         return -1;
     }
     
-    if (saddr->sa_family == AF_INET6) {
-        memset (&addr6, 0, sizeof(struct sockaddr_in6));
-        addr6.sin6_family = AF_INET6;
-#ifdef __APPLE__
-        addr6.sin6_len = sizeof(struct sockaddr_in6);
-#endif
-        addr6.sin6_addr.s6_addr[0] = 0xFF;
-        addr6.sin6_addr.s6_addr[1] = 0x02;
-        addr6.sin6_addr.s6_addr[15] = 0xFB;
-        addr6.sin6_port = htons((unsigned short)5353);
-        saddr = (struct sockaddr*)&addr6;
-        saddrlen = sizeof(struct sockaddr_in6);
-    } else if (saddr->sa_family == AF_INET) {
-        memset(&addr, 0, sizeof(struct sockaddr_in));
-        addr.sin_family = AF_INET;
-#ifdef __APPLE__
-        addr.sin_len = sizeof(struct sockaddr_in);
-#endif
-        addr.sin_addr.s_addr = htonl((((uint32_t)224U) << 24U) | ((uint32_t)251U));
-        addr.sin_port = htons((unsigned short)5353);
-        saddr = (struct sockaddr*)&addr;
-        saddrlen = sizeof(struct sockaddr_in);
-    }
+    const struct sockaddr* saddr = (itIface->second.sa_family == AF_INET6) ?
+        (const struct sockaddr*)&_mdnsGroupIpv6 :
+        (const struct sockaddr*)&_mdnsGroupIpv4;
     
     LOG->debug ("sendPacket: size: %lu", packet->size());
     
@@ -597,100 +1665,110 @@ void Client::announceAAAA (
     }
 }
 
-void Client::sendResponseA (
-    uv_udp_t* handleFrom, 
-    uint32_t ttl) 
+void Client::buildResponseTemplates () 
 {
   
-    //NOTE: Query could be received on IPv4 but must be announce to
-    // IPv6 as well
+    //NOTE: Query could be received on IPv4 but must be announced with
+    // the IPv6 address of the same interface as well, and vice versa.
+    // Templates are encoded once with every interface already open.
   
-    auto itIface = _udpHandleToInterface.find (handleFrom);
-    if (itIface != _udpHandleToInterface.end()) {
-        auto ifaceName = itIface->second.name;
-        auto it = _ifaceToUdpHandleIpv4.find (ifaceName);  
-        if (it != _ifaceToUdpHandleIpv4.end()) {
-          
-            uv_udp_t* handleTo = it->second;
-            auto itIPv4Iface = _udpHandleToInterface.find (handleTo);
-            if (itIPv4Iface != _udpHandleToInterface.end()) {
-          
-                struct sockaddr_in saddr;                              
-                if (uv_ip4_addr (itIPv4Iface->second.ipAddress.c_str(), 0, &saddr) == 0) {
-                
-                    auto response = DnsPacket::NewResponseA (_uuid,
-                                                              ttl,
-                                                              &saddr);
-                    
-                    LOG->info ("Send RECORD TYPE A with TTL [%] via [%: %]", ttl, ifaceName, itIface->second.ipAddress);
-                    sendPacket (handleFrom, response);
-                } else {
-                    LOG->error ("sendResponseA: error on uv_ip4_addr with ip address: %", itIPv4Iface->second.ipAddress);
-                }                
+    for (auto& udpHandle: _udpHandleToInterface) {
+      
+        auto& ifaceName = udpHandle.second.name;
+        
+        auto itIpv4 = _ifaceToUdpHandleIpv4.find (ifaceName);
+        if (itIpv4 != _ifaceToUdpHandleIpv4.end()) {
+            auto& ipAddress = _udpHandleToInterface[itIpv4->second].ipAddress;
+            struct sockaddr_in saddr;
+            if (uv_ip4_addr (ipAddress.c_str(), 0, &saddr) == 0) {
+                DnsPacket::Encoder encoder (0x8400U); // Standard Query response, no error
+                encoder.addRecordA (DnsPacket::ENTRYTYPE_ANSWER, _uuid, DEFAULT_TTL, &saddr);
+                _responseTemplatesA[udpHandle.first] = { encoder.getPacket(), encoder.getLastTtlOffset() };
+            } else {
+                LOG->error ("buildResponseTemplates: error on uv_ip4_addr with ip address: %", ipAddress);
+            }
+        }
+        
+        auto itIpv6 = _ifaceToUdpHandleIpv6.find (ifaceName);
+        if (itIpv6 != _ifaceToUdpHandleIpv6.end()) {
+            auto& ipAddress = _udpHandleToInterface[itIpv6->second].ipAddress;
+            struct sockaddr_in6 saddr;
+            if (uv_ip6_addr (ipAddress.c_str(), 0, &saddr) == 0) {
+                DnsPacket::Encoder encoder (0x8400U); // Standard Query response, no error
+                encoder.addRecordAAAA (DnsPacket::ENTRYTYPE_ANSWER, _uuid, DEFAULT_TTL, &saddr);
+                _responseTemplatesAAAA[udpHandle.first] = { encoder.getPacket(), encoder.getLastTtlOffset() };
+            } else {
+                LOG->error ("buildResponseTemplates: error on uv_ip6_addr with ip address: %", ipAddress);
             }
         }
     }
 }
 
+void Client::sendResponse (
+    std::map<uv_udp_t*, responseTemplate_t>& templates,
+    uv_udp_t* handleFrom, 
+    uint32_t ttl,
+    uint16_t transactionId) 
+{
+    auto it = templates.find (handleFrom);
+    if (it == templates.end()) {
+        return;
+    }
+    
+    //NOTE: only the transaction id and TTL change between sends
+    auto& packet = *it->second.packet;
+    size_t ttlOffset = it->second.ttlOffset;
+    packet[0] = (uint8_t)(transactionId >> 8);
+    packet[1] = (uint8_t)(transactionId & 0xFF);
+    packet[ttlOffset]     = (uint8_t)(ttl >> 24);
+    packet[ttlOffset + 1] = (uint8_t)(ttl >> 16);
+    packet[ttlOffset + 2] = (uint8_t)(ttl >> 8);
+    packet[ttlOffset + 3] = (uint8_t)(ttl & 0xFF);
+    
+    sendPacket (handleFrom, it->second.packet);
+}
+
+void Client::sendResponseA (
+    uv_udp_t* handleFrom, 
+    uint32_t ttl) 
+{
+    LOG->info ("Send RECORD TYPE A with TTL [%]", ttl);
+    sendResponse (_responseTemplatesA, handleFrom, ttl, 0);
+}
+
 void Client::sendResponseAAAA (
     uv_udp_t* handleFrom, 
     uint32_t ttl) 
 {
-  
-    //NOTE: Query could be received on IPv6 but must be announce to
-    // IPv4 as well
-  
-    auto itIface = _udpHandleToInterface.find (handleFrom);
-    if (itIface != _udpHandleToInterface.end()) {
-        auto ifaceName = itIface->second.name;
-        auto it = _ifaceToUdpHandleIpv6.find (ifaceName);  
-        if (it != _ifaceToUdpHandleIpv6.end()) {
-          
-            uv_udp_t* handleTo = it->second;
-            auto itIPv6Iface = _udpHandleToInterface.find (handleTo);
-            if (itIPv6Iface != _udpHandleToInterface.end()) {
-          
-                struct sockaddr_in6 saddr;                              
-                if (uv_ip6_addr (itIPv6Iface->second.ipAddress.c_str(), 0, &saddr) == 0) {
-                
-                    auto response = DnsPacket::NewResponseAAAA (_uuid,
-                                                                 ttl,
-                                                                 &saddr);
-                    
-                    LOG->info ("Send RECORD TYPE A with TTL [%] via [%: %]", ttl, ifaceName, itIface->second.ipAddress);
-                    sendPacket (handleFrom, response);
-                } else {
-                    LOG->error ("sendResponseA: error on uv_ip4_addr with ip address: %", itIPv6Iface->second.ipAddress);
-                }                
-            }
-        }
-    }
+    LOG->info ("Send RECORD TYPE AAAA with TTL [%]", ttl);
+    sendResponse (_responseTemplatesAAAA, handleFrom, ttl, 0);
 }
 
 void Client::printCache () {
     
-    auto now = time (NULL);
+    auto now = uv_now (_loop);
+    
+    auto print = [&](uint16_t type) {
+        _cache.forEach ([&](const RecordCache::entry_t& entry) {
+            if (entry.type == type) {
+                LOG->info ("| % | % |           % |", 
+                           _cache.getName (entry), 
+                           RecordCache::AddressToString (entry), 
+                           ((int64_t)entry.expiration - (int64_t)now) / 1000);
+            }
+        });
+    };
         
     LOG->info ("==============================================================================");
     LOG->info ("|                                IPv4                                        |");
     LOG->info ("------------------------------------------------------------------------------");
     LOG->info ("|  name                                      | address       | TTL (seconds) |");
     LOG->info ("------------------------------------------------------------------------------");
-    for (auto& record: _recordsA) {
-        auto name    = record.first;
-        auto ttl     = record.second.first;
-        auto address = record.second.second;
-        LOG->info ("| % | % |           % |", name, address, ttl-now);
-    }
+    print (DnsPacket::RECORDTYPE_A);
     LOG->info ("------------------------------------------------------------------------------");
     LOG->info ("|                                IPv6                                        |");
     LOG->info ("------------------------------------------------------------------------------");
-    for (auto& record: _recordsAAAA) {
-        auto name    = record.first;
-        auto ttl     = record.second.first;
-        auto address = record.second.second;
-        LOG->info ("| % | % |           % |", name, address, ttl-now);
-    }
+    print (DnsPacket::RECORDTYPE_AAAA);
     LOG->info ("==============================================================================");
 }
 
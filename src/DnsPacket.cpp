@@ -1,5 +1,11 @@
 #include <cstring>
+#include <algorithm>
 #include <arpa/inet.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "Logger.hpp"
 #include "DnsPacket.hpp"
 
@@ -9,198 +15,515 @@ std::shared_ptr<Logger> DnsPacket::LOG = Logger::Get("DnsPacket");
 
 uint16_t DnsPacket::transactionId = 0x0000U;
 
-std::shared_ptr<std::vector<uint8_t>> DnsPacket::NewQueryA (
-  const std::string& name) 
+//NOTE: DNS names compare case insensitively (RFC 4343). Labels are
+// folded and compared 32 (AVX2) or 16 (SSE2) bytes at a time, with a
+// scalar loop for the tail and for other architectures.
+
+static inline uint8_t foldCase (
+    uint8_t c) 
 {
-      
-    auto packet = std::make_shared<std::vector<uint8_t>> ();
-    packet->reserve(100);
-    
-    //Transaction ID
-    addUint16 (packet, htons(transactionId));
-    //Flags
-    addUint16 (packet, htons(0));
-    //Questions
-    addUint16 (packet, htons(1));
-    //No answer, authority or additional RRs
-    addUint16 (packet, htons(0));
-    addUint16 (packet, htons(0));
-    addUint16 (packet, htons(0));
-    //Name string
-    addString (packet, name);
-    //Record type
-    addUint16 (packet, htons(RECORDTYPE_A));
-    //! Unicast response, class IN
-    //*data++ = htons(0x8000U | CLASS_IN);
-    //! Multicast response, class IN
-    addUint16 (packet, htons(0x0000U | CLASS_IN));
-    
-    return packet;
+    return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+}
 
+#if defined(__SSE2__)
+static inline __m128i foldCase16 (
+    __m128i v) 
+{
+    //NOTE: signed compares, bytes >= 0x80 are negative and never upper case
+    __m128i upper = _mm_and_si128 (_mm_cmpgt_epi8 (v, _mm_set1_epi8 ('A' - 1)),
+                                   _mm_cmplt_epi8 (v, _mm_set1_epi8 ('Z' + 1)));
+    return _mm_or_si128 (v, _mm_and_si128 (upper, _mm_set1_epi8 (0x20)));
 }
+#endif
 
-std::shared_ptr<std::vector<uint8_t>> DnsPacket::NewResponseA (
-    const std::string& name,
-    uint32_t ttl,
-    struct sockaddr_in *addr)
+#if defined(__AVX2__)
+static inline __m256i foldCase32 (
+    __m256i v) 
 {
-  
-    auto packet = std::make_shared<std::vector<uint8_t>> ();
-    packet->reserve(100);
+    __m256i upper = _mm256_and_si256 (_mm256_cmpgt_epi8 (v, _mm256_set1_epi8 ('A' - 1)),
+                                      _mm256_cmpgt_epi8 (_mm256_set1_epi8 ('Z' + 1), v));
+    return _mm256_or_si256 (v, _mm256_and_si256 (upper, _mm256_set1_epi8 (0x20)));
+}
+#endif
 
+static inline bool equalsIgnoreCase (
+    const uint8_t* a,
+    const uint8_t* b,
+    size_t length)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= length; i += 32) {
+        __m256i va = foldCase32 (_mm256_loadu_si256 ((const __m256i*)(a + i)));
+        __m256i vb = foldCase32 (_mm256_loadu_si256 ((const __m256i*)(b + i)));
+        if (_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (va, vb)) != -1) {
+            return false;
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 <= length; i += 16) {
+        __m128i va = foldCase16 (_mm_loadu_si128 ((const __m128i*)(a + i)));
+        __m128i vb = foldCase16 (_mm_loadu_si128 ((const __m128i*)(b + i)));
+        if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (va, vb)) != 0xFFFF) {
+            return false;
+        }
+    }
+#endif
+    for (; i < length; i++) {
+        if (foldCase (a[i]) != foldCase (b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline void foldCaseCopy (
+    const uint8_t* in,
+    uint8_t* out,
+    size_t length)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= length; i += 32) {
+        _mm256_storeu_si256 ((__m256i*)(out + i), 
+                             foldCase32 (_mm256_loadu_si256 ((const __m256i*)(in + i))));
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 <= length; i += 16) {
+        _mm_storeu_si128 ((__m128i*)(out + i), 
+                          foldCase16 (_mm_loadu_si128 ((const __m128i*)(in + i))));
+    }
+#endif
+    for (; i < length; i++) {
+        out[i] = foldCase (in[i]);
+    }
+}
+
+static const uint64_t HASH_SEED = 0xcbf29ce484222325ULL;
+static const uint64_t HASH_MUL  = 0x9e3779b97f4a7c15ULL;
+
+//NOTE: a name of MAX_NAME_LENGTH has at most this many labels
+static const size_t MAX_LABELS = DnsPacket::MAX_NAME_LENGTH / 2 + 1;
+static const size_t INITIAL_SUFFIX_SLOTS = 32;
+
+static inline uint64_t hashMix (
+    uint64_t hash,
+    uint64_t word)
+{
+    hash = (hash ^ word) * HASH_MUL;
+    return hash ^ (hash >> 29);
+}
+
+//NOTE: hashes one label (length and folded bytes) 8 bytes at a time
+static inline uint64_t hashLabel (
+    uint64_t hash,
+    const uint8_t* label,
+    size_t length)
+{
+    uint8_t folded[DnsPacket::MAX_LABEL_LENGTH + 1];
+    
+    hash = hashMix (hash, length);
+    
+    while (length > 0) {
+        size_t chunk = length < sizeof(folded) ? length : sizeof(folded);
+        foldCaseCopy (label, folded, chunk);
+        
+        size_t i = 0;
+        for (; i + 8 <= chunk; i += 8) {
+            uint64_t word;
+            std::memcpy (&word, folded + i, 8);
+            hash = hashMix (hash, word);
+        }
+        if (i < chunk) {
+            uint64_t word = 0;
+            std::memcpy (&word, folded + i, chunk - i);
+            hash = hashMix (hash, word);
+        }
+        label  = label + chunk;
+        length = length - chunk;
+    }
+    return hash;
+}
+
+bool DnsPacket::EqualsIgnoreCase (
+    const char* a,
+    const char* b,
+    size_t length)
+{
+    return equalsIgnoreCase ((const uint8_t*)a, (const uint8_t*)b, length);
+}
+
+DnsPacket::Encoder::Encoder (
+    uint16_t flags,
+    size_t maxSize)
+: _packet (std::make_shared<std::vector<uint8_t>> ()),
+  _maxSize (maxSize)
+{
+    _packet->reserve (maxSize < 512 ? maxSize : 512);
     // Transaction ID
-    addUint16 (packet, htons(transactionId));
+    putUint16 (transactionId);
     // Flags
-    addUint16 (packet, htons(0x8400)); // Standard Query response, no error;
-    // Questions
-    addUint16 (packet, htons(0));
-    // Answer RRs
-    addUint16 (packet, htons(1));
-    // Authority RRs
-    addUint16 (packet, htons(0));
-    // Additional RRs
-    addUint16 (packet, htons(0));
-    // Name string
-    addString (packet, name);
+    putUint16 (flags);
+    // Questions, Answer, Authority and Additional RRs, patched on add
+    putUint16 (0);
+    putUint16 (0);
+    putUint16 (0);
+    putUint16 (0);
+}
+
+bool DnsPacket::Encoder::addQuestion (
+    const std::string& name,
+    uint16_t qtype,
+    bool unicast)
+{
+    if (_section != 0) {
+        LOG->error ("Encoder: question added after records: %", name);
+        return false;
+    }
+    
+    size_t mark = begin();
+    putName (name);
     // Record type
-    addUint16 (packet, htons(RECORDTYPE_A));
-    // CacheFlush, Class IN, 
-    addUint16 (packet, htons(0x8000U | CLASS_IN));
-    // TTL 120 seconds
-    addUint32 (packet, htonl(ttl));
-    // Data lenght 4
-    addUint16 (packet, htons(0x04));
-    // IPv4 Address
-    for (int i = 0; i < 4; i++) {
-        packet->push_back (((uint8_t*)&addr->sin_addr.s_addr)[i]);
-    }   
-        
-    return packet;
+    putUint16 (qtype);
+    //! Unicast (0x8000) or multicast response, class IN
+    putUint16 ((unicast ? 0x8000U : 0x0000U) | CLASS_IN);
+    
+    return commit (mark, 0);
 }
 
-std::shared_ptr<std::vector<uint8_t>> DnsPacket::NewResponseAAAA (
+bool DnsPacket::Encoder::addRecord (
+    entry_type_t section,
     const std::string& name,
+    uint16_t rtype,
+    bool cacheFlush,
     uint32_t ttl,
-    struct sockaddr_in6 *addr)
+    const void* rdata,
+    uint16_t length)
 {
-  
-    auto packet = std::make_shared<std::vector<uint8_t>> ();
-    packet->reserve(100);
-
-    // Transaction ID
-    addUint16 (packet, htons(transactionId));
-    // Flags
-    addUint16 (packet, htons(0x8400)); // Standard Query response, no error;
-    // Questions
-    addUint16 (packet, htons(0));
-    // Answer RRs
-    addUint16 (packet, htons(1));
-    // Authority RRs
-    addUint16 (packet, htons(0));
-    // Additional RRs
-    addUint16 (packet, htons(0));
-    // Name string
-    addString (packet, name);
+    if (section < _section) {
+        LOG->error ("Encoder: record for section % added after section %", section, _section);
+        return false;
+    }
+    
+    size_t mark = begin();
+    putName (name);
     // Record type
-    addUint16 (packet, htons(RECORDTYPE_AAAA));
-    // CacheFlush, Class IN, 
-    addUint16 (packet, htons(0x8000U | CLASS_IN));
-    // TTL 120 seconds
-    addUint32 (packet, htonl(ttl));
-    // Data lenght 16
-    addUint16 (packet, htons(0x10));
-    // IPv6 Address
-    for (int i = 0; i < 16; i++) {
-        packet->push_back (((uint8_t*)&addr->sin6_addr)[i]);
-    }   
-        
-    return packet;
+    putUint16 (rtype);
+    // CacheFlush, Class IN
+    putUint16 ((cacheFlush ? CACHE_FLUSH : 0x0000U) | CLASS_IN);
+    // TTL
+    _lastTtlOffset = _packet->size();
+    putUint32 (ttl);
+    // Data length and data
+    putUint16 (length);
+    _packet->insert (_packet->end(), 
+                     (const uint8_t*)rdata, 
+                     (const uint8_t*)rdata + length);
+    
+    return commit (mark, section);
+}
+
+bool DnsPacket::Encoder::addRecordA (
+    entry_type_t section,
+    const std::string& name,
+    uint32_t ttl,
+    const struct sockaddr_in* addr,
+    bool cacheFlush)
+{
+    return addRecord (section, name, RECORDTYPE_A, cacheFlush, ttl, &addr->sin_addr, 4);
+}
+
+bool DnsPacket::Encoder::addRecordAAAA (
+    entry_type_t section,
+    const std::string& name,
+    uint32_t ttl,
+    const struct sockaddr_in6* addr,
+    bool cacheFlush)
+{
+    return addRecord (section, name, RECORDTYPE_AAAA, cacheFlush, ttl, &addr->sin6_addr, 16);
 }
 
-inline void DnsPacket::addUint16 (
-    std::shared_ptr<std::vector<uint8_t>> packet, 
+bool DnsPacket::Encoder::addRecordPTR (
+    entry_type_t section,
+    const std::string& name,
+    uint32_t ttl,
+    const std::string& target)
+{
+    if (section < _section) {
+        LOG->error ("Encoder: record for section % added after section %", section, _section);
+        return false;
+    }
+    
+    size_t mark = begin();
+    putName (name);
+    putUint16 (RECORDTYPE_PTR);
+    putUint16 (CLASS_IN);
+    _lastTtlOffset = _packet->size();
+    putUint32 (ttl);
+    //NOTE: length is known once the target has been compressed
+    size_t lengthOffset = _packet->size();
+    putUint16 (0);
+    putName (target);
+    size_t length = _packet->size() - lengthOffset - 2;
+    (*_packet)[lengthOffset]     = (uint8_t)(length >> 8);
+    (*_packet)[lengthOffset + 1] = (uint8_t)(length & 0xFF);
+    
+    return commit (mark, section);
+}
+
+uint16_t DnsPacket::Encoder::getCount (
+    int section) const
+{
+    size_t at = 4 + 2 * section;
+    return (uint16_t)(((*_packet)[at] << 8) | (*_packet)[at + 1]);
+}
+
+void DnsPacket::Encoder::setTruncated ()
+{
+    (*_packet)[2] |= (uint8_t)(FLAG_TRUNCATED >> 8);
+}
+
+size_t DnsPacket::Encoder::begin ()
+{
+    _suffixesMark = _suffixes.size();
+    return _packet->size();
+}
+
+bool DnsPacket::Encoder::commit (
+    size_t mark,
+    int section)
+{
+    if (_packet->size() > _maxSize || _packet->size() > 0xFFFF) {
+        //NOTE: roll back, the entry does not fit
+        _packet->resize (mark);
+        if (_suffixes.size() > _suffixesMark) {
+            _suffixes.resize (_suffixesMark);
+            indexSuffixes (_suffixSlots.size());
+        }
+        return false;
+    }
+    _section = section;
+    size_t at = 4 + 2 * section;
+    uint16_t count = getCount (section) + 1;
+    (*_packet)[at]     = (uint8_t)(count >> 8);
+    (*_packet)[at + 1] = (uint8_t)(count & 0xFF);
+    return true;
+}
+
+void DnsPacket::Encoder::putUint16 (
     uint16_t value) 
 {
-    packet->push_back ((uint8_t)(value & 0x00FF));        // LOW byte
-    packet->push_back ((uint8_t)((value & 0xFF00) >> 8)); // HIGH byte
+    _packet->push_back ((uint8_t)((value & 0xFF00) >> 8)); // HIGH byte
+    _packet->push_back ((uint8_t)(value & 0x00FF));        // LOW byte
 }
 
-inline void DnsPacket::addUint32 (
-    std::shared_ptr<std::vector<uint8_t>> packet, 
+void DnsPacket::Encoder::putUint32 (
     uint32_t value) 
 {
-    packet->push_back ((uint8_t)((value & 0x000000FF)));     
-    packet->push_back ((uint8_t)((value & 0x0000FF00) >> 8));
-    packet->push_back ((uint8_t)((value & 0x00FF0000) >> 16));
-    packet->push_back ((uint8_t)((value & 0xFF000000) >> 24));
+    _packet->push_back ((uint8_t)((value & 0xFF000000) >> 24));
+    _packet->push_back ((uint8_t)((value & 0x00FF0000) >> 16));
+    _packet->push_back ((uint8_t)((value & 0x0000FF00) >> 8));
+    _packet->push_back ((uint8_t)((value & 0x000000FF)));
 }
 
-inline uint16_t DnsPacket::getUint16 (
-    std::shared_ptr<std::vector<uint8_t>> packet, 
-    size_t &cursor) 
+void DnsPacket::Encoder::putName (
+    const std::string& name) 
 {
-    int val = 0;
-    if (cursor+1 >= packet->size()) {
-        LOG->error ("getUint16: Error packet->size: % cursor: %", 
-                    packet->size(), 
-                    cursor);
+    //NOTE: labels of the name, then the hash of the suffix starting at
+    // each one, chained right to left
+    size_t   starts[MAX_LABELS];
+    size_t   lengths[MAX_LABELS];
+    uint64_t hashes[MAX_LABELS + 1];
+    uint16_t offsets[MAX_LABELS];
+    size_t   count = 0;
+    size_t   start = 0;
+    
+    while (start < name.size()) {
+        if (count == MAX_LABELS) {
+            LOG->error ("Encoder: too many labels in name: %", name);
+            break;
+        }
+        size_t end = name.find ('.', start);
+        if (end == std::string::npos) {
+            end = name.size();
+        }
+        size_t length = end - start;
+        if (length > MAX_LABEL_LENGTH) {
+            LOG->error ("Encoder: label too long in name: %", name);
+            length = MAX_LABEL_LENGTH;
+        }
+        starts[count]  = start;
+        lengths[count] = length;
+        count++;
+        start = end + 1;
+    }
+    
+    hashes[count] = HASH_SEED;
+    for (size_t i = count; i > 0; i--) {
+        hashes[i - 1] = hashLabel (hashes[i], (const uint8_t*)name.data() + starts[i - 1], lengths[i - 1]);
+    }
+    
+    //NOTE: longest suffix first, reuse it if it was already written.
+    // The hash only finds the candidate, matchName confirms it
+    size_t written = count;
+    const suffix_t* suffix = nullptr;
+    for (size_t i = 0; i < count; i++) {
+        suffix = findSuffix (hashes[i]);
+        if (suffix != nullptr && 
+            matchName (_packet->data(), _packet->size(), suffix->offset, 
+                       name.data() + starts[i], name.size() - starts[i])) 
+        {
+            written = i;
+            break;
+        }
+        suffix = nullptr;
+    }
+    
+    for (size_t i = 0; i < written; i++) {
+        offsets[i] = (uint16_t)_packet->size();
+        _packet->push_back ((uint8_t)lengths[i]);
+        _packet->insert (_packet->end(), 
+                         name.begin() + starts[i], 
+                         name.begin() + starts[i] + lengths[i]);
+    }
+    if (suffix != nullptr) {
+        putUint16 (0xC000U | suffix->offset);
     } else {
-        uint8_t lowByte  = packet->at (cursor++);
-        uint8_t highByte = packet->at (cursor++);
-        val = highByte;
-        val = val << 8;
-        val |= lowByte;
+        _packet->push_back (0x00);
+    }
+    
+    //NOTE: indexed once the name is complete, so a later lookup never
+    // lands on an unterminated name. Pointers only have 14 bits of offset
+    for (size_t i = 0; i < written; i++) {
+        if (offsets[i] < 0x4000U) {
+            addSuffix (hashes[i], offsets[i]);
+        }
     }
-    return val;
 }
 
-inline uint16_t DnsPacket::getUint32 (
-    std::shared_ptr<std::vector<uint8_t>> packet, 
-    size_t &cursor) 
+const DnsPacket::Encoder::suffix_t* DnsPacket::Encoder::findSuffix (
+    uint64_t hash) const
 {
-    uint32_t val = 0;
-    if (cursor >= packet->size()) {
-        LOG->error ("getUint16: Error packet->size: % cursor: %", 
-                    packet->size(), 
-                    cursor);
-    } else {
-        val = packet->at(cursor);
-        val = val << 8;
-        val = val | packet->at(cursor+1);
-        val = val << 8;
-        val = val | packet->at(cursor+2);
-        val = val << 8;
-        val = val | packet->at(cursor+3);
-        cursor = cursor + sizeof(val);
+    if (_suffixSlots.empty()) {
+        return nullptr;
+    }
+    size_t mask = _suffixSlots.size() - 1;
+    for (size_t i = hash & mask; _suffixSlots[i] != 0; i = (i + 1) & mask) {
+        const suffix_t& suffix = _suffixes[_suffixSlots[i] - 1];
+        if (suffix.hash == hash) {
+            return &suffix;
+        }
     }
-    return val;
+    return nullptr;
 }
 
-void DnsPacket::addString (
-    std::shared_ptr<std::vector<uint8_t>> packet, 
-    const std::string& name) 
+void DnsPacket::Encoder::addSuffix (
+    uint64_t hash,
+    uint16_t offset)
 {
-    size_t pos = 0;
-    size_t last_pos = 0;
+    //NOTE: the first copy of a suffix is as good a target as any other
+    if (findSuffix (hash) != nullptr) {
+        return;
+    }
+    if (_suffixSlots.empty()) {
+        _suffixes.reserve (INITIAL_SUFFIX_SLOTS / 2);
+        indexSuffixes (INITIAL_SUFFIX_SLOTS);
+    }
+    _suffixes.push_back ({ hash, offset });
     
-    while ((last_pos < name.size()) && 
-           ((pos = name.find_first_of (".", last_pos)) != std::string::npos)) 
-    {
-        size_t sublength = pos - last_pos;
-        packet->push_back((uint8_t)sublength);
-        std::copy (name.begin()+last_pos, 
-                   name.begin()+last_pos+sublength, 
-                   std::back_inserter(*packet));
-        last_pos = pos + 1;
+    if (2 * _suffixes.size() > _suffixSlots.size()) {
+        indexSuffixes (2 * _suffixSlots.size());
+        return;
+    }
+    size_t mask = _suffixSlots.size() - 1;
+    size_t i = hash & mask;
+    while (_suffixSlots[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    _suffixSlots[i] = (uint32_t)_suffixes.size();
+}
+
+void DnsPacket::Encoder::indexSuffixes (
+    size_t slots)
+{
+    _suffixSlots.assign (slots, 0);
+    size_t mask = slots - 1;
+    for (size_t position = 0; position < _suffixes.size(); position++) {
+        size_t i = _suffixes[position].hash & mask;
+        while (_suffixSlots[i] != 0) {
+            i = (i + 1) & mask;
+        }
+        _suffixSlots[i] = (uint32_t)(position + 1);
+    }
+}
+
+std::shared_ptr<std::vector<uint8_t>> DnsPacket::NewQueryA (
+  const std::string& name) 
+{
+    Encoder encoder (0x0000U);
+    encoder.addQuestion (name, RECORDTYPE_A);
+    return encoder.getPacket();
+}
+
+std::shared_ptr<std::vector<uint8_t>> DnsPacket::NewResponseA (
+    const std::string& name,
+    uint32_t ttl,
+    struct sockaddr_in *addr)
+{
+    // Standard Query response, no error
+    Encoder encoder (0x8400U);
+    encoder.addRecordA (ENTRYTYPE_ANSWER, name, ttl, addr, true);
+    return encoder.getPacket();
+}
+
+std::shared_ptr<std::vector<uint8_t>> DnsPacket::NewResponseAAAA (
+    const std::string& name,
+    uint32_t ttl,
+    struct sockaddr_in6 *addr)
+{
+    // Standard Query response, no error
+    Encoder encoder (0x8400U);
+    encoder.addRecordAAAA (ENTRYTYPE_ANSWER, name, ttl, addr, true);
+    return encoder.getPacket();
+}
+
+inline bool DnsPacket::getUint16 (
+    const uint8_t* data,
+    size_t size,
+    size_t &cursor,
+    uint16_t& value) 
+{
+    if (cursor + 2 > size) {
+        LOG->error ("getUint16: Error packet size: % cursor: %", 
+                    size, 
+                    cursor);
+        return false;
     }
-    if (last_pos < name.size()) {
-        size_t sublength = name.size() - last_pos;
-        packet->push_back ((uint8_t)sublength);
-        std::copy (name.begin()+last_pos, 
-                   name.begin()+last_pos+sublength,
-                   std::back_inserter(*packet));
+    value = (uint16_t)((data[cursor] << 8) | data[cursor+1]);
+    cursor = cursor + 2;
+    return true;
+}
+
+inline bool DnsPacket::getUint32 (
+    const uint8_t* data,
+    size_t size,
+    size_t &cursor,
+    uint32_t& value) 
+{
+    if (cursor + 4 > size) {
+        LOG->error ("getUint32: Error packet size: % cursor: %", 
+                    size, 
+                    cursor);
+        return false;
     }
-    packet->push_back(0x00);
+    value = ((uint32_t)data[cursor]   << 24) |
+            ((uint32_t)data[cursor+1] << 16) |
+            ((uint32_t)data[cursor+2] << 8)  |
+             (uint32_t)data[cursor+3];
+    cursor = cursor + 4;
+    return true;
 }
 
 bool DnsPacket::isStringPointer (
@@ -210,250 +533,619 @@ bool DnsPacket::isStringPointer (
     return res;
 }
 
-std::shared_ptr<std::string> DnsPacket::getLabel (
-    std::shared_ptr<std::vector<uint8_t>> buffer, 
-    size_t& offset,
-    int32_t &pointerReturnAddress)
+bool DnsPacket::skipName (
+    const uint8_t* data,
+    size_t size,
+    size_t& cursor)
 {
-     
-    std::shared_ptr<std::string> result = nullptr;
-        
-    if (offset >= buffer->size()) {
-        // ERROR
-        LOG->error ("getLabel: error 1");
-    } else if (!buffer->at(offset)) {       
-        // END
-        LOG->debug ("getLabel: end");
-    } else {
-        
-        if (isStringPointer (buffer->at(offset))) {
-                             
-            if (buffer->size() < offset + 2) {
-                // ERROR
-                LOG->error ("getLabel: error 2");
-            } else {
-
-                size_t stringPointerStart = 
-                    ((((size_t)(0x3f & buffer->at(offset))) << 8) |
-                    (size_t)buffer->at(offset + 1));
-                
-                LOG->debug ("getLabel: pointer to %", stringPointerStart);
-                if (stringPointerStart >= buffer->size()) {
-                    // ERROR
-                    LOG->error ("getLabel: error 3");
-                } else {                                                
-                    size_t stringLength = (size_t)buffer->at(stringPointerStart);
-                    
-                    if (buffer->size() < stringPointerStart + stringLength) {
-                        // ERROR
-                        LOG->error ("getLabel: error 4");
-                    } else {
-                        result = std::make_shared<std::string>(
-                                    (char*)buffer->data()+(stringPointerStart+1), 
-                                    stringLength);
-                        
-                        //NOTE: Check if end of string or label
-                        if (pointerReturnAddress == -1) {                            
-                            pointerReturnAddress = (offset+2);
-                            LOG->debug ("getLabel: pointerReturnAddress: %", 
-                                        pointerReturnAddress);
-                        } else {
-                            LOG->debug ("getLabel: double indirection");
-                        }
-                        offset = stringPointerStart+1+stringLength;
-                    }
-                }
-            }          
-        } else {
+    //NOTE: walks the labels of a name without decoding them. A compression
+    // pointer always terminates the name at this position.
+    while (cursor < size) {
+        uint8_t length = data[cursor];
+        if (length == 0) {
+            cursor = cursor + 1;
+            return true;
+        } else if (isStringPointer (length)) {
+            if (cursor + 2 > size) {
+                break;
+            }
+            cursor = cursor + 2;
+            return true;
+        } else if (length & 0xC0) {
+            LOG->error ("skipName: unsupported label type: % at: %", length, cursor);
+            return false;
+        }
+        cursor = cursor + 1 + length;
+    }
+    LOG->error ("skipName: Error packet size: % cursor: %", size, cursor);
+    return false;
+}
 
-            size_t stringLength = (size_t)buffer->at(offset);
-            if (buffer->size() < offset + stringLength) {
-                // ERROR
-                LOG->error ("getLabel: error 5: stringLength: % offset: % size: %",
-                            stringLength, 
-                            offset, 
-                            buffer->size());
-            } else {
-                result = std::make_shared<std::string>(
-                            (char*)buffer->data()+(offset+1), 
-                            stringLength);
-                offset = offset + 1 + stringLength;
+bool DnsPacket::nextLabel (
+    const uint8_t* data,
+    size_t size,
+    size_t& cursor,
+    size_t& limit,
+    size_t& labelOffset,
+    uint8_t& length)
+{
+    while (cursor < size) {
+        uint8_t value = data[cursor];
+        if (isStringPointer (value)) {
+            if (cursor + 2 > size) {
+                break;
             }
+            size_t target = (((size_t)(0x3f & value)) << 8) | (size_t)data[cursor + 1];
+            //NOTE: loop protection, each jump must land strictly before
+            // every position visited so far
+            if (target >= limit) {
+                LOG->error ("nextLabel: invalid compression pointer to: % at: %", target, cursor);
+                return false;
+            }
+            limit = target;
+            cursor = target;
+        } else if (value & 0xC0) {
+            LOG->error ("nextLabel: unsupported label type: % at: %", value, cursor);
+            return false;
+        } else if (cursor + 1 + value > size) {
+            break;
+        } else {
+            labelOffset = cursor;
+            length = value;
+            cursor = cursor + 1 + value;
+            return true;
         }
     }
+    LOG->error ("nextLabel: Error packet size: % cursor: %", size, cursor);
+    return false;
+}
+
+bool DnsPacket::Packet::decodeName (
+    uint16_t offset,
+    std::string& out) const
+{
+  
+    out.clear();
     
-    LOG->debug ("getLabel got: % offset: %", 
-                (result?result->c_str():"NULL"),
-                offset);
+    //NOTE: labels decoded in this call, as <offset, position in out>
+    // so their suffixes can be memoized once the name is complete.
+    uint16_t labelOffsets[128];
+    uint16_t labelPositions[128];
+    size_t   numLabels = 0;
+
+    size_t cursor = offset;
+    size_t limit  = offset;
+    size_t labelOffset = 0;
+    uint8_t length = 0;
     
-    return result;
+    while (true) {
+        if (!nextLabel (data, size, cursor, limit, labelOffset, length)) {
+            out.clear();
+            return false;
+        }
+        if (length == 0) {
+            break;
+        }
+        
+        const suffix_t* suffix = findSuffix (labelOffset);
+        if (!out.empty()) {
+            out.push_back ('.');
+        }
+        if (suffix != nullptr) {
+            out.append (_suffixText, suffix->start, suffix->length);
+            break;
+        }
+        
+        if (numLabels == 128 || out.size() + length > MAX_NAME_LENGTH) {
+            LOG->error ("decodeName: name too long at: %", offset);
+            out.clear();
+            return false;
+        }
+        labelOffsets[numLabels]   = labelOffset;
+        labelPositions[numLabels] = out.size();
+        numLabels++;
+        out.append ((const char*)data + labelOffset + 1, length);
+    }
+    
+    if (numLabels > 0) {
+        uint32_t start = _suffixText.size();
+        _suffixText.append (out);
+        for (size_t i = 0; i < numLabels; i++) {
+            addSuffix (labelOffsets[i], 
+                       start + labelPositions[i], 
+                       out.size() - labelPositions[i]);
+        }
+    }
+    
+    return true;
+}
+
+const DnsPacket::Packet::suffix_t* DnsPacket::Packet::findSuffix (
+    uint16_t offset) const
+{
+    if (_suffixCount == 0) {
+        return nullptr;
+    }
+    size_t mask = _suffixes.size() - 1;
+    for (size_t i = offset & mask; ; i = (i + 1) & mask) {
+        if (_suffixes[i].offset == offset) {
+            return &_suffixes[i];
+        } else if (_suffixes[i].offset == 0) {
+            return nullptr;
+        }
+    }
+}
+
+void DnsPacket::Packet::addSuffix (
+    uint16_t offset,
+    uint32_t start,
+    uint16_t length) const
+{
+    //NOTE: open addressing keyed by label offset. Offset 0 is the header
+    // and never starts a name, so it marks empty slots.
+    if ((_suffixCount + 1) * 2 > _suffixes.size()) {
+        std::vector<suffix_t> old;
+        old.swap (_suffixes);
+        _suffixes.assign (old.empty() ? 64 : old.size() * 2, suffix_t{0, 0, 0});
+        _suffixCount = 0;
+        for (auto& suffix: old) {
+            if (suffix.offset != 0) {
+                addSuffix (suffix.offset, suffix.start, suffix.length);
+            }
+        }
+    }
+    size_t mask = _suffixes.size() - 1;
+    for (size_t i = offset & mask; ; i = (i + 1) & mask) {
+        if (_suffixes[i].offset == offset) {
+            return;
+        } else if (_suffixes[i].offset == 0) {
+            _suffixes[i] = suffix_t{offset, length, start};
+            _suffixCount++;
+            return;
+        }
+    }
 }
 
-std::string DnsPacket::getString (
-    std::shared_ptr<std::vector<uint8_t>> buffer, 
-    size_t& offset) 
+std::string DnsPacket::Name::toString () const 
 {
- 
-    size_t cur = offset;
     std::string result;
-    bool first = true;
-    int32_t pointerReturnAddress = -1;
-            
-    std::shared_ptr<std::string> substr = nullptr;
+    if (packet != nullptr) {
+        packet->decodeName (offset, result);
+    }
+    return result;
+}
+
+bool DnsPacket::matchName (
+    const uint8_t* data,
+    size_t size,
+    size_t offset,
+    const char* name,
+    size_t nameLength)
+{
+    //NOTE: compares label by label against the dotted name, no decoding.
+    // DNS names are case insensitive.
+    size_t cursor = offset;
+    size_t limit  = offset;
+    size_t labelOffset = 0;
+    uint8_t length = 0;
+    size_t pos = 0;
     
-    LOG->debug ("getString: offset: %", offset);
+    if (nameLength > 0 && name[nameLength - 1] == '.') {
+        nameLength--;
+    }
     
-    do {        
-        if (cur >= buffer->size()) {
-            substr = nullptr;
-            LOG->error ("getString: Error packet->size: % cursor: %", 
-                        buffer->size(), 
-                        cur);
-        } else {
-            substr = getLabel (buffer, cur, pointerReturnAddress);
-            if (substr != nullptr) {            
-                if (!first) {
-                    result.append(".");
-                } else {
-                    first = false;
-                }
-                result.append (*substr);
-            } else if (pointerReturnAddress != -1) {                
-                LOG->debug ("getString: returning from pointer at: % next: %", 
-                            cur, 
-                            (uint8_t)buffer->at(cur));
+    while (nextLabel (data, size, cursor, limit, labelOffset, length)) {
+        if (length == 0) {
+            return pos == nameLength;
+        }
+        if (pos != 0) {
+            if (pos >= nameLength || name[pos] != '.') {
+                return false;
             }
+            pos++;
+        }
+        if (nameLength - pos < length || 
+            !equalsIgnoreCase ((const uint8_t*)name + pos, data + labelOffset + 1, length)) 
+        {
+            return false;
+        }
+        pos = pos + length;
+    }
+    return false;
+}
+
+bool DnsPacket::Name::equals (
+    const std::string& name) const
+{
+    if (packet == nullptr) {
+        return false;
+    }
+    return matchName (packet->data, packet->size, offset, name.data(), name.size());
+}
+
+DnsPacket::Scanner::Scanner (
+    const uint8_t* data,
+    size_t size)
+: _data (data),
+  _size (size)
+{
+    size_t cursor = 2;
+    _valid = getUint16 (data, size, cursor, _flags)      &&
+             getUint16 (data, size, cursor, _counts[0])  &&
+             getUint16 (data, size, cursor, _counts[1])  &&
+             getUint16 (data, size, cursor, _counts[2])  &&
+             getUint16 (data, size, cursor, _counts[3]);
+}
+
+bool DnsPacket::Scanner::next ()
+{
+    if (!_valid) {
+        return false;
+    }
+    
+    while (_index >= _counts[_section]) {
+        if (_section == 3) {
+            return false;
         }
-    } while (substr != nullptr);
+        _section++;
+        _index = 0;
+    }
+    _index++;
     
-    if (pointerReturnAddress != -1) {
-        offset = pointerReturnAddress;
+    _nameOffset = _cursor;
+    if (!skipName (_data, _size, _cursor) || 
+        !getUint16 (_data, _size, _cursor, _type)) 
+    {
+        _valid = false;
+        return false;
+    }
+    
+    if (_section == 0) {
+        // Class
+        _cursor = _cursor + 2;
     } else {
-        offset = cur + 1;
+        // Class, TTL, length and data
+        uint16_t length = 0;
+        _cursor = _cursor + 6;
+        if (!getUint16 (_data, _size, _cursor, length)) {
+            _valid = false;
+            return false;
+        }
+        _cursor = _cursor + length;
     }
-        
-    LOG->debug ("getString got: %", result);
+    if (_cursor > _size) {
+        _valid = false;
+        return false;
+    }
+    return true;
+}
+
+uint64_t DnsPacket::Scanner::getNameHash () const
+{
+    return HashName (_data, _size, _nameOffset);
+}
+
+bool DnsPacket::Scanner::nameEquals (
+    const std::string& name) const
+{
+    return matchName (_data, _size, _nameOffset, name.data(), name.size());
+}
+
+uint64_t DnsPacket::HashName (
+    const uint8_t* data,
+    size_t size,
+    size_t offset)
+{
+    uint64_t hash = HASH_SEED;
+    size_t cursor = offset;
+    size_t limit  = offset;
+    size_t labelOffset = 0;
+    uint8_t length = 0;
     
-    return result;
+    do {
+        if (!nextLabel (data, size, cursor, limit, labelOffset, length)) {
+            return 0;
+        }
+        hash = hashLabel (hash, data + labelOffset + 1, length);
+    } while (length != 0);
+    
+    return hash;
+}
+
+uint64_t DnsPacket::HashName (
+    const std::string& name)
+{
+    uint64_t hash = HASH_SEED;
+    size_t start = 0;
+    
+    while (start < name.size()) {
+        size_t end = name.find ('.', start);
+        if (end == std::string::npos) {
+            end = name.size();
+        }
+        size_t length = end - start;
+        hash = hashLabel (hash, (const uint8_t*)name.data() + start, length);
+        start = end + 1;
+    }
+    // Root label
+    hash = hashLabel (hash, nullptr, 0);
+    
+    return hash;
+}
+
+std::ostream& operator<< (
+    std::ostream& os, 
+    const DnsPacket::Name& name)
+{
+    return os << name.toString();
 }
 
 std::shared_ptr<DnsPacket::Packet> DnsPacket::Parse (
     std::shared_ptr<std::vector<uint8_t>> buffer) 
 {
+    auto packet = Parse (buffer->data(), buffer->size());
+    if (packet) {
+        packet->_storage = buffer;
+    }
+    return packet;
+}
+
+void DnsPacket::Packet::clear () 
+{
+    transactionId = 0;
+    flags = 0;
+    questionsRRS = 0;
+    answerRRS = 0;
+    authorityRRS = 0;
+    additionalRRS = 0;
+    //NOTE: clear() keeps capacity, so a reused packet does not allocate
+    questions.clear();
+    records.clear();
+    data = nullptr;
+    size = 0;
+    _storage = nullptr;
+    if (_suffixCount > 0) {
+        std::fill (_suffixes.begin(), _suffixes.end(), suffix_t{0, 0, 0});
+        _suffixCount = 0;
+    }
+    _suffixText.clear();
+}
+
+std::shared_ptr<DnsPacket::Packet> DnsPacket::Parse (
+    const uint8_t* data,
+    size_t size) 
+{
+    auto packet = std::make_shared<Packet>();
+    if (!Parse (data, size, *packet)) {
+        return nullptr;
+    }
+    return packet;
+}
+
+bool DnsPacket::Parse (
+    const uint8_t* data,
+    size_t size,
+    Packet& packet) 
+{
 
     LOG->debug("Parse: --START--");
   
-    auto packet = std::make_shared<Packet>();
+    packet.clear();
+    packet.data = data;
+    packet.size = size;
 
     size_t cursor = 0;
     
-    packet->transactionId = ntohs (getUint16 (buffer, cursor));
-    packet->flags         = ntohs (getUint16 (buffer, cursor));
-    packet->questionsRRS  = ntohs (getUint16 (buffer, cursor));
-    packet->answerRRS     = ntohs (getUint16 (buffer, cursor));
-    packet->authorityRRS  = ntohs (getUint16 (buffer, cursor));
-    packet->additionalRRS = ntohs (getUint16 (buffer, cursor));
+    if (!getUint16 (data, size, cursor, packet.transactionId) ||
+        !getUint16 (data, size, cursor, packet.flags)         ||
+        !getUint16 (data, size, cursor, packet.questionsRRS)  ||
+        !getUint16 (data, size, cursor, packet.answerRRS)     ||
+        !getUint16 (data, size, cursor, packet.authorityRRS)  ||
+        !getUint16 (data, size, cursor, packet.additionalRRS))
+    {
+        LOG->error ("Parse: truncated header size: %", size);
+        return false;
+    }
     
-    LOG->debug ("parse: transactionId: %", packet->transactionId);
-    LOG->debug ("parse: questions: %", packet->questionsRRS);
-    LOG->debug ("parse: answerRRS: %", packet->answerRRS);
-    LOG->debug ("parse: authorityRRS: %", packet->authorityRRS);
-    LOG->debug ("parse: additionalRRS: %", packet->additionalRRS);
+    LOG->debug ("parse: transactionId: %", packet.transactionId);
+    LOG->debug ("parse: questions: %", packet.questionsRRS);
+    LOG->debug ("parse: answerRRS: %", packet.answerRRS);
+    LOG->debug ("parse: authorityRRS: %", packet.authorityRRS);
+    LOG->debug ("parse: additionalRRS: %", packet.additionalRRS);
 
     // Questions
-    for (int i = 0; i < packet->questionsRRS; ++i) {
-
-        LOG->debug ("parse: question: % of %", i, packet->questionsRRS);
-        auto question    = std::make_shared<Question>();         
-        question->name   = getString (buffer, cursor);        
-        question->qtype  = ntohs (getUint16 (buffer, cursor));
-        question->qclass = ntohs (getUint16 (buffer, cursor));
-        question->unicast = !(question->qclass & 0x8000U);
-        packet->questions.push_back (question);
-        LOG->debug ("parse: got question name: % type: % class: %", 
-                    question->name, 
-                    question->qtype, 
-                    question->qclass);
-    }
+    for (int i = 0; i < packet.questionsRRS; ++i) {
 
-    for (int i = 0; i < packet->answerRRS; i++) {
-        auto record = parseRecord (buffer, cursor, ENTRYTYPE_ANSWER);
-        if (record) {
-            packet->records.push_back (record);
-        }
-    }
-    
-    for (int i = 0; i < packet->authorityRRS; i++) {
-        auto record = parseRecord (buffer, cursor, ENTRYTYPE_AUTHORITY);
-        if (record) {
-            packet->records.push_back (record);
+        LOG->debug ("parse: question: % of %", i, packet.questionsRRS);
+        packet.questions.emplace_back ();
+        auto& question = packet.questions.back();
+        question.name.packet = &packet;
+        question.name.offset = cursor;
+        if (!skipName (data, size, cursor) ||
+            !getUint16 (data, size, cursor, question.qtype) ||
+            !getUint16 (data, size, cursor, question.qclass)) 
+        {
+            LOG->error ("Parse: truncated question: %", i);
+            return false;
         }
+        question.unicast = !(question.qclass & 0x8000U);
+        LOG->debug ("parse: got question name: % type: % class: %", 
+                    question.name, 
+                    question.qtype, 
+                    question.qclass);
     }
+
+    const uint16_t sections[] = { 
+        packet.answerRRS, 
+        packet.authorityRRS, 
+        packet.additionalRRS 
+    };
+    const entry_type_t types[] = { 
+        ENTRYTYPE_ANSWER, 
+        ENTRYTYPE_AUTHORITY, 
+        ENTRYTYPE_ADDITIONAL 
+    };
     
-    for (int i = 0; i < packet->additionalRRS; i++) {
-        auto record = parseRecord (buffer, cursor, ENTRYTYPE_ADDITIONAL);
-        if (record) {
-            packet->records.push_back (record);
+    for (int s = 0; s < 3; s++) {
+        for (int i = 0; i < sections[s]; i++) {
+            packet.records.emplace_back ();
+            auto& record = packet.records.back();
+            record.name.packet = &packet;
+            record.target.packet = &packet;
+            if (!parseRecord (data, size, cursor, types[s], record)) {
+                LOG->error ("Parse: truncated record: % of section: %", i, types[s]);
+                return false;
+            }
         }
     }
     
     LOG->debug("Parse: --END--");
     
-    return packet;
+    return true;
+}
+
+bool DnsPacket::NsecHasType (
+    const Record& record,
+    uint16_t type)
+{
+    if (type > 255) {
+        return true;
+    }
+    return record.data.nsec[type >> 3] & (0x80 >> (type & 7));
 }
 
-std::shared_ptr<DnsPacket::Record> DnsPacket::parseRecord (
-    std::shared_ptr<std::vector<uint8_t>> buffer,
+bool DnsPacket::parseRecord (
+    const uint8_t* data,
+    size_t size,
     size_t& cursor,
-    entry_type_t type) 
+    entry_type_t type,
+    Record& record) 
 {
-    auto record = std::make_shared<DnsPacket::Record>();
+    record.name.offset = cursor;
     
-    record->name = getString (buffer, cursor);    
-    record->rtype  = ntohs(getUint16 (buffer, cursor));
+    if (!skipName (data, size, cursor) ||
+        !getUint16 (data, size, cursor, record.rtype)  ||
+        !getUint16 (data, size, cursor, record.rclass) ||
+        !getUint32 (data, size, cursor, record.ttl)    ||
+        !getUint16 (data, size, cursor, record.length))
+    {
+        return false;
+    }
     
-    LOG->debug ("parseRecord: got name: % type: %", record->name.c_str(), record->rtype);
-
-    record->rclass = ntohs(getUint16 (buffer, cursor));
-    record->ttl    = getUint32 (buffer, cursor);
-    record->length = ntohs(getUint16 (buffer, cursor));
+    LOG->debug ("parseRecord: got name: % type: %", record.name, record.rtype);
+    
+    if (cursor + record.length > size) {
+        LOG->error ("parseRecord: rdata out of bounds length: % cursor: % size: %", 
+                    record.length, 
+                    cursor, 
+                    size);
+        return false;
+    }
+    
+    record.cacheFlush = record.rclass & CACHE_FLUSH;
         
-    if (record->rtype == RECORDTYPE_A) {        
+    if (record.rtype == RECORDTYPE_A) {        
         LOG->debug ("parseRecord: got RECORDTYPE_A");
         
-        record->cacheFlush = record->rclass & CACHE_FLUSH;
-        
-        memset ((void*)&record->data.a, 0, sizeof(struct sockaddr_in));
-        record->data.a.sin_family = AF_INET;
+        memset ((void*)&record.data.a, 0, sizeof(struct sockaddr_in));
+        record.data.a.sin_family = AF_INET;
         #ifdef __APPLE__
-        record->data.a.sin_len = sizeof(struct sockaddr_in);
+        record.data.a.sin_len = sizeof(struct sockaddr_in);
         #endif
-        if ((buffer->size() >= cursor + record->length) && (record->length == 4)) {
-            std::memcpy (&record->data.a.sin_addr.s_addr, buffer->data()+cursor, 4);
-            cursor = cursor + 4;
+        if (record.length == 4) {
+            std::memcpy (&record.data.a.sin_addr.s_addr, data+cursor, 4);
         }
-    } else if (record->rtype == RECORDTYPE_AAAA) {
+    } else if (record.rtype == RECORDTYPE_AAAA) {
       
         LOG->debug ("parseRecord: got RECORDTYPE_AAAA");
         
-        record->cacheFlush = record->rclass & CACHE_FLUSH;
-        
-        memset ((void*)&record->data.aaaa, 0, sizeof(struct sockaddr_in));
-        record->data.aaaa.sin6_family = AF_INET6;
+        memset ((void*)&record.data.aaaa, 0, sizeof(struct sockaddr_in6));
+        record.data.aaaa.sin6_family = AF_INET6;
         #ifdef __APPLE__
-        record->data.aaaa.sin6_len = sizeof(struct sockaddr_in6);
+        record.data.aaaa.sin6_len = sizeof(struct sockaddr_in6);
         #endif
-        if ((buffer->size() >= cursor + record->length) && (record->length == 16)) {          
-            std::memcpy (&record->data.aaaa.sin6_addr, buffer->data()+cursor, 16);
-            cursor = cursor + 16;
+        if (record.length == 16) {          
+            std::memcpy (&record.data.aaaa.sin6_addr, data+cursor, 16);
         }
             
+    } else if (record.rtype == RECORDTYPE_NSEC) {
+      
+        LOG->debug ("parseRecord: got RECORDTYPE_NSEC");
+        
+        //NOTE: next domain name then (window, length, bitmap) blocks,
+        // only window 0 is kept. A malformed bitmap asserts every type
+        // so it never denies one.
+        size_t end = cursor + record.length;
+        size_t position = cursor;
+        bool valid = skipName (data, size, position) && position <= end;
+        
+        memset (record.data.nsec, 0, sizeof(record.data.nsec));
+        while (valid && position < end) {
+            if (position + 2 > end) {
+                valid = false;
+                break;
+            }
+            uint8_t window = data[position];
+            uint8_t length = data[position + 1];
+            position += 2;
+            if (length == 0 || length > 32 || position + length > end) {
+                valid = false;
+                break;
+            }
+            if (window == 0) {
+                std::memcpy (record.data.nsec, data + position, length);
+            }
+            position += length;
+        }
+        if (!valid) {
+            LOG->warn ("parseRecord: malformed NSEC bitmap");
+            memset (record.data.nsec, 0xFF, sizeof(record.data.nsec));
+        }
+        
+    } else if (record.rtype == RECORDTYPE_PTR) {
+      
+        LOG->debug ("parseRecord: got RECORDTYPE_PTR");
+        
+        size_t position = cursor;
+        record.target.offset = (uint16_t)position;
+        if (!skipName (data, size, position) || position > cursor + record.length) {
+            LOG->error ("parseRecord: malformed PTR target");
+            return false;
+        }
+        
+    } else if (record.rtype == RECORDTYPE_SRV) {
+      
+        LOG->debug ("parseRecord: got RECORDTYPE_SRV");
+        
+        //NOTE: priority, weight, port then the target name (RFC 2782)
+        size_t position = cursor;
+        if (!getUint16 (data, size, position, record.data.srv.priority) ||
+            !getUint16 (data, size, position, record.data.srv.weight)   ||
+            !getUint16 (data, size, position, record.data.srv.port))
+        {
+            return false;
+        }
+        record.target.offset = (uint16_t)position;
+        if (!skipName (data, size, position) || position > cursor + record.length) {
+            LOG->error ("parseRecord: malformed SRV target");
+            return false;
+        }
+        
+    } else if (record.rtype == RECORDTYPE_TXT) {
+      
+        LOG->debug ("parseRecord: got RECORDTYPE_TXT");
+        
+        //NOTE: character-strings are left in place, read them through
+        // the packet data
+        record.data.txt.offset = (uint16_t)cursor;
+        
     } else {
-        LOG->debug ("parseRecord: ignoring record type: %", record->rtype);
-        cursor = cursor + record->length;
+        LOG->debug ("parseRecord: ignoring record type: %", record.rtype);
     }
+    
+    cursor = cursor + record.length;
         
-    return record;
+    return true;
 }
 
 }
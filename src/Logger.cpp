@@ -31,6 +31,11 @@ void Logger::setLogLevel (
     _logLevel = level;
 }
 
+Logger::LOG_LEVEL Logger::getLogLevel () 
+{
+    return _logLevel;
+}
+
 void Logger::setLogFunction (
     std::function<void(LOG_LEVEL, 
                        const std::string& tag, 
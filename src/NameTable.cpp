@@ -0,0 +1,171 @@
+#include "NameTable.hpp"
+
+namespace MDns {
+
+std::shared_ptr<Logger> NameTable::LOG = Logger::Get("NameTable");
+
+//NOTE: bound by reference in assign(), needs a definition without optimizations
+const NameTable::id_t NameTable::INVALID_ID;
+
+static const size_t INITIAL_SLOTS = 64;
+
+NameTable::NameTable ()
+{
+    _slots.assign (INITIAL_SLOTS, INVALID_ID);
+}
+
+template <typename M>
+NameTable::id_t NameTable::findId (
+    uint64_t hash,
+    M matches) const
+{
+    size_t mask = _slots.size() - 1;
+    for (size_t i = hash & mask; _slots[i] != INVALID_ID; i = (i + 1) & mask) {
+        const name_t& entry = _names[_slots[i] - 1];
+        if (entry.hash == hash && matches (entry.name)) {
+            return _slots[i];
+        }
+    }
+    return INVALID_ID;
+}
+
+NameTable::id_t NameTable::find (
+    const std::string& name) const
+{
+    return findId (DnsPacket::HashName (name), [&](const std::string& entry) {
+        return entry.size() == name.size() &&
+               DnsPacket::EqualsIgnoreCase (entry.data(), name.data(), name.size());
+    });
+}
+
+NameTable::id_t NameTable::find (
+    const DnsPacket::Name& name,
+    uint64_t hash) const
+{
+    return findId (hash, [&](const std::string& entry) {
+        return name.equals (entry);
+    });
+}
+
+NameTable::id_t NameTable::intern (
+    const std::string& name)
+{
+    id_t id = find (name);
+    if (id == INVALID_ID) {
+        name_t& entry = add (DnsPacket::HashName (name), id);
+        entry.name.assign (name);
+    }
+    retain (id);
+    return id;
+}
+
+NameTable::id_t NameTable::intern (
+    const DnsPacket::Name& name,
+    uint64_t hash)
+{
+    id_t id = find (name, hash);
+    if (id == INVALID_ID) {
+        std::string decoded;
+        if (!name.packet->decodeName (name.offset, decoded)) {
+            LOG->error ("intern: malformed name at: %", name.offset);
+            return INVALID_ID;
+        }
+        name_t& entry = add (hash, id);
+        entry.name.swap (decoded);
+    }
+    retain (id);
+    return id;
+}
+
+void NameTable::retain (
+    id_t id)
+{
+    _names[id - 1].refs++;
+}
+
+void NameTable::release (
+    id_t id)
+{
+    name_t& entry = _names[id - 1];
+    if (--entry.refs > 0) {
+        return;
+    }
+
+    size_t mask = _slots.size() - 1;
+    size_t i = entry.hash & mask;
+    while (_slots[i] != id) {
+        i = (i + 1) & mask;
+    }
+
+    //NOTE: backward shift deletion, keeps probe sequences without
+    // tombstones
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & mask;
+        if (_slots[j] == INVALID_ID) {
+            break;
+        }
+        size_t k = _names[_slots[j] - 1].hash & mask;
+        bool movable = (i <= j) ? (k <= i || k > j) : (k <= i && k > j);
+        if (movable) {
+            _slots[i] = _slots[j];
+            i = j;
+        }
+    }
+    _slots[i] = INVALID_ID;
+
+    entry.name.clear();
+    _freeIds.push_back (id);
+    _size--;
+}
+
+NameTable::name_t& NameTable::add (
+    uint64_t hash,
+    id_t& id)
+{
+    //NOTE: keep the load factor under 1/2
+    if ((_size + 1) * 2 > _slots.size()) {
+        grow();
+    }
+
+    if (!_freeIds.empty()) {
+        id = _freeIds.back();
+        _freeIds.pop_back();
+    } else {
+        _names.emplace_back ();
+        id = _names.size();
+    }
+
+    name_t& entry = _names[id - 1];
+    entry.hash = hash;
+    entry.refs = 0;
+
+    size_t mask = _slots.size() - 1;
+    size_t i = hash & mask;
+    while (_slots[i] != INVALID_ID) {
+        i = (i + 1) & mask;
+    }
+    _slots[i] = id;
+    _size++;
+
+    return entry;
+}
+
+void NameTable::grow ()
+{
+    std::vector<id_t> slots (_slots.size() * 2, INVALID_ID);
+    size_t mask = slots.size() - 1;
+    for (id_t id: _slots) {
+        if (id == INVALID_ID) {
+            continue;
+        }
+        size_t i = _names[id - 1].hash & mask;
+        while (slots[i] != INVALID_ID) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = id;
+    }
+    _slots.swap (slots);
+}
+
+}
@@ -0,0 +1,620 @@
+#include <cstring>
+#include <uv.h>
+#include "RecordCache.hpp"
+#include "CacheSnapshot.hpp"
+
+namespace MDns {
+
+std::shared_ptr<Logger> RecordCache::LOG = Logger::Get("RecordCache");
+
+static const size_t INITIAL_SLOTS = 64;
+static const size_t NOT_FOUND = (size_t)-1;
+static const uint32_t NIL = 0xFFFFFFFFU;
+//NOTE: RFC 6762 5.2, refresh queries at 80, 85, 90 and 95% of the TTL
+static const uint8_t REFRESH_POINTS = 4;
+
+RecordCache::RecordCache (
+    NameTable& names,
+    uint64_t now) :
+    _names (names),
+    _expiry (now)
+{
+    _random = (uint32_t)(now ^ (now >> 32)) | 1;
+    _slots.assign (INITIAL_SLOTS, 0);
+}
+
+bool RecordCache::sameAddress (
+    const entry_t& entry,
+    const address_t& address)
+{
+    return !entry.negative && 
+           std::memcmp (&entry.address, &address, AddressLength (entry.type)) == 0;
+}
+
+template <typename M>
+size_t RecordCache::findSlot (
+    uint64_t hash,
+    uint16_t type,
+    M matches) const
+{
+    size_t mask = _slots.size() - 1;
+    for (size_t i = home (hash, type, mask); ; i = (i + 1) & mask) {
+        uint32_t index = _slots[i];
+        if (index == 0) {
+            return NOT_FOUND;
+        }
+        const entry_t& entry = _entries[index - 1];
+        if (entry.hash == hash && entry.type == type && matches (entry)) {
+            return i;
+        }
+    }
+}
+
+const RecordCache::entry_t* RecordCache::lookup (
+    const std::string& name,
+    uint16_t type,
+    uint64_t now)
+{
+    NameTable::id_t id = _names.find (name);
+    const entry_t* newest = nullptr;
+    if (id != NameTable::INVALID_ID) {
+        size_t mask = _slots.size() - 1;
+        for (size_t i = home (_names.hash (id), type, mask); _slots[i] != 0; i = (i + 1) & mask) {
+            const entry_t& entry = _entries[_slots[i] - 1];
+            if (entry.name == id && entry.type == type && !entry.negative && 
+                entry.expiration > now && (newest == nullptr || entry.received > newest->received)) 
+            {
+                newest = &entry;
+            }
+        }
+    }
+    
+    if (newest == nullptr) {
+        _stats.misses++;
+        return nullptr;
+    }
+    
+    _stats.hits++;
+    touch (id, type, now);
+    return newest;
+}
+
+const RecordCache::entry_t* RecordCache::find (
+    const DnsPacket::Name& name,
+    uint64_t hash,
+    uint16_t type,
+    const address_t& address) const
+{
+    NameTable::id_t id = _names.find (name, hash);
+    if (id == NameTable::INVALID_ID) {
+        return nullptr;
+    }
+    size_t slot = findSlot (hash, type, [&](const entry_t& entry) {
+        return entry.name == id && sameAddress (entry, address);
+    });
+    return slot == NOT_FOUND ? nullptr : &_entries[_slots[slot] - 1];
+}
+
+const RecordCache::entry_t* RecordCache::update (
+    const DnsPacket::Name& name,
+    uint64_t hash,
+    uint16_t type,
+    uint32_t ttl,
+    const address_t& address,
+    uint64_t now)
+{
+    NameTable::id_t id = _names.intern (name, hash);
+    if (id == NameTable::INVALID_ID) {
+        return nullptr;
+    }
+    return update (id, type, ttl, address, now);
+}
+
+const RecordCache::entry_t* RecordCache::update (
+    const std::string& name,
+    uint16_t type,
+    uint32_t ttl,
+    const address_t& address,
+    uint64_t now)
+{
+    return update (_names.intern (name), type, ttl, address, now);
+}
+
+const RecordCache::entry_t* RecordCache::update (
+    NameTable::id_t id,
+    uint16_t type,
+    uint32_t ttl,
+    const address_t& address,
+    uint64_t now)
+{
+    uint64_t hash = _names.hash (id);
+    if (_negatives > 0) {
+        size_t negative = findSlot (hash, type, [&](const entry_t& entry) {
+            return entry.name == id && entry.negative;
+        });
+        if (negative != NOT_FOUND) {
+            eraseSlot (negative);
+        }
+    }
+    
+    size_t slot = findSlot (hash, type, [&](const entry_t& entry) {
+        return entry.name == id && sameAddress (entry, address);
+    });
+    entry_t* entry;
+    if (slot != NOT_FOUND) {
+        entry = &_entries[_slots[slot] - 1];
+        _names.release (id);
+    } else {
+        entry = &insert (id, type);
+    }
+    refresh (*entry, ttl, address, now);
+    return entry;
+}
+
+void RecordCache::refresh (
+    entry_t& entry,
+    uint32_t ttl,
+    const address_t& address,
+    uint64_t now)
+{
+    entry.ttl = ttl;
+    entry.received = now;
+    entry.expiration = now + (uint64_t)ttl * 1000;
+    entry.refreshes = 0;
+    std::memcpy (&entry.address, &address, AddressLength (entry.type));
+    schedule (entry, now);
+    changed (entry, now);
+}
+
+bool RecordCache::isHot (
+    const entry_t& entry,
+    uint64_t now)
+{
+    //NOTE: a TTL of 1 second marks a record being withdrawn (RFC 6762
+    // 10.1), it is not refreshed
+    return !entry.negative &&
+           entry.ttl > 1 &&
+           entry.lastLookup != 0 && 
+           now - entry.lastLookup < (uint64_t)entry.ttl * 1000;
+}
+
+uint64_t RecordCache::deadline (
+    entry_t& entry,
+    uint64_t now)
+{
+    if (!isHot (entry, now)) {
+        return entry.expiration;
+    }
+    
+    while (entry.refreshes < REFRESH_POINTS) {
+        
+        //NOTE: plus 0-2% of the TTL, so hosts caching the same record
+        // do not all ask at once
+        _random ^= _random << 13;
+        _random ^= _random >> 17;
+        _random ^= _random << 5;
+        uint64_t point = RefreshPoint (entry.received, entry.ttl, entry.refreshes, _random % 21);
+        
+        if (point >= entry.expiration) {
+            break;
+        }
+        if (point > now) {
+            return point;
+        }
+        //NOTE: looked up too late for this one
+        entry.refreshes++;
+    }
+    return entry.expiration;
+}
+
+void RecordCache::schedule (
+    entry_t& entry,
+    uint64_t now)
+{
+    uint32_t index = &entry - _entries.data();
+    uint64_t when  = deadline (entry, now);
+    if (entry.timer == TimerWheel::INVALID_HANDLE) {
+        entry.timer = _expiry.schedule (when, index);
+    } else {
+        _expiry.reschedule (entry.timer, when);
+    }
+}
+
+void RecordCache::changed (
+    const entry_t& entry,
+    uint64_t now)
+{
+    if (entry.negative) {
+        return;
+    }
+    _version++;
+    if (_snapshot != nullptr) {
+        _snapshot->store (&entry - _entries.data(), entry, getName (entry), now);
+    }
+}
+
+const RecordCache::entry_t* RecordCache::restore (
+    const std::string& name,
+    uint16_t type,
+    uint32_t ttl,
+    const address_t& address,
+    uint64_t remaining,
+    uint64_t now)
+{
+    const entry_t* entry = update (name, type, ttl, address, now);
+    entry_t& restored = const_cast<entry_t&>(*entry);
+    restored.expiration = now + remaining;
+    //NOTE: as if received when its TTL started, keeps the refresh and
+    // known answer arithmetic right
+    restored.received = restored.expiration > (uint64_t)ttl * 1000 ? 
+                        restored.expiration - (uint64_t)ttl * 1000 : 0;
+    schedule (restored, now);
+    changed (restored, now);
+    return entry;
+}
+
+void RecordCache::touch (
+    const std::string& name,
+    uint16_t type,
+    uint64_t now)
+{
+    NameTable::id_t id = _names.find (name);
+    if (id != NameTable::INVALID_ID) {
+        touch (id, type, now);
+    }
+}
+
+void RecordCache::touch (
+    NameTable::id_t id,
+    uint16_t type,
+    uint64_t now)
+{
+    size_t mask = _slots.size() - 1;
+    for (size_t i = home (_names.hash (id), type, mask); _slots[i] != 0; i = (i + 1) & mask) {
+        entry_t& entry = _entries[_slots[i] - 1];
+        if (entry.name != id || entry.type != type || entry.negative) {
+            continue;
+        }
+        bool hot = isHot (entry, now);
+        entry.lastLookup = now;
+        lruUnlink (_slots[i] - 1);
+        lruPush (_slots[i] - 1);
+        //NOTE: a hot entry timer already points at its next refresh
+        if (!hot) {
+            schedule (entry, now);
+        }
+    }
+}
+
+void RecordCache::setSnapshot (
+    CacheSnapshot* snapshot)
+{
+    _snapshot = snapshot;
+}
+
+void RecordCache::flush (
+    const DnsPacket::Name& name,
+    uint64_t hash,
+    uint16_t type,
+    uint64_t now)
+{
+    NameTable::id_t id = _names.find (name, hash);
+    if (id == NameTable::INVALID_ID) {
+        return;
+    }
+    size_t mask = _slots.size() - 1;
+    for (size_t i = home (hash, type, mask); _slots[i] != 0; i = (i + 1) & mask) {
+        entry_t& entry = _entries[_slots[i] - 1];
+        if (entry.name != id || entry.type != type || entry.negative || 
+            now - entry.received <= 1000 || entry.expiration <= now + 1000) 
+        {
+            continue;
+        }
+        entry.expiration = now + 1000;
+        schedule (entry, now);
+        changed (entry, now);
+    }
+}
+
+void RecordCache::addNegative (
+    const DnsPacket::Name& name,
+    uint64_t hash,
+    uint16_t type,
+    uint64_t lifetime,
+    uint64_t now)
+{
+    NameTable::id_t id = _names.intern (name, hash);
+    if (id != NameTable::INVALID_ID) {
+        negative (id, type, lifetime, now);
+    }
+}
+
+void RecordCache::addNegative (
+    const std::string& name,
+    uint16_t type,
+    uint64_t lifetime,
+    uint64_t now)
+{
+    negative (_names.intern (name), type, lifetime, now);
+}
+
+void RecordCache::negative (
+    NameTable::id_t id,
+    uint16_t type,
+    uint64_t lifetime,
+    uint64_t now)
+{
+    size_t slot = findSlot (_names.hash (id), type, [&](const entry_t& entry) {
+        return entry.name == id && entry.negative;
+    });
+    entry_t* entry;
+    if (slot != NOT_FOUND) {
+        entry = &_entries[_slots[slot] - 1];
+        _names.release (id);
+    } else {
+        entry = &insert (id, type);
+        entry->negative = true;
+        std::memset (&entry->address, 0, sizeof(entry->address));
+        _negatives++;
+    }
+    entry->ttl = lifetime / 1000;
+    entry->received = now;
+    entry->expiration = now + lifetime;
+    schedule (*entry, now);
+}
+
+bool RecordCache::isNegative (
+    const std::string& name,
+    uint16_t type,
+    uint64_t now)
+{
+    if (_negatives == 0) {
+        return false;
+    }
+    NameTable::id_t id = _names.find (name);
+    if (id == NameTable::INVALID_ID) {
+        return false;
+    }
+    size_t slot = findSlot (_names.hash (id), type, [&](const entry_t& entry) {
+        return entry.name == id && entry.negative && entry.expiration > now;
+    });
+    if (slot == NOT_FOUND) {
+        return false;
+    }
+    _stats.negativeHits++;
+    return true;
+}
+
+bool RecordCache::eraseNegative (
+    const DnsPacket::Name& name,
+    uint64_t hash,
+    uint16_t type)
+{
+    NameTable::id_t id = _names.find (name, hash);
+    size_t slot = id == NameTable::INVALID_ID ? NOT_FOUND : findSlot (hash, type, [&](const entry_t& entry) {
+        return entry.name == id && entry.negative;
+    });
+    if (slot == NOT_FOUND) {
+        return false;
+    }
+    eraseSlot (slot);
+    return true;
+}
+
+bool RecordCache::erase (
+    const DnsPacket::Name& name,
+    uint64_t hash,
+    uint16_t type,
+    const address_t& address)
+{
+    NameTable::id_t id = _names.find (name, hash);
+    size_t slot = id == NameTable::INVALID_ID ? NOT_FOUND : findSlot (hash, type, [&](const entry_t& entry) {
+        return entry.name == id && sameAddress (entry, address);
+    });
+    if (slot == NOT_FOUND) {
+        return false;
+    }
+    eraseSlot (slot);
+    return true;
+}
+
+RecordCache::entry_t& RecordCache::insert (
+    NameTable::id_t id,
+    uint16_t type)
+{
+    uint64_t hash = _names.hash (id);
+
+    while (_maxEntries > 0 && _size >= _maxEntries) {
+        evict();
+    }
+
+    //NOTE: keep the load factor under 1/2
+    if ((_size + 1) * 2 > _slots.size()) {
+        grow();
+    }
+
+    uint32_t index;
+    if (!_freeEntries.empty()) {
+        index = _freeEntries.back();
+        _freeEntries.pop_back();
+    } else {
+        _entries.emplace_back ();
+        index = _entries.size() - 1;
+    }
+
+    entry_t& entry = _entries[index];
+    entry.name = id;
+    entry.hash = hash;
+    entry.type = type;
+    entry.ttl  = 0;
+    entry.received = 0;
+    entry.expiration = 0;
+    entry.lastLookup = 0;
+    entry.refreshes = 0;
+    entry.timer = TimerWheel::INVALID_HANDLE;
+    entry.negative = false;
+    entry.used = true;
+
+    size_t mask = _slots.size() - 1;
+    size_t i = home (hash, type, mask);
+    while (_slots[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    _slots[i] = index + 1;
+    _size++;
+    lruPush (index);
+
+    return entry;
+}
+
+void RecordCache::setMaxEntries (
+    size_t maxEntries)
+{
+    _maxEntries = maxEntries;
+    while (_maxEntries > 0 && _size > _maxEntries) {
+        evict();
+    }
+}
+
+void RecordCache::evict ()
+{
+    LOG->debug ("evict: % type: %", getName (_entries[_lruTail]), _entries[_lruTail].type);
+    eraseEntry (_lruTail);
+    _stats.evictions++;
+}
+
+void RecordCache::lruPush (
+    uint32_t index)
+{
+    entry_t& entry = _entries[index];
+    entry.lruPrev = NIL;
+    entry.lruNext = _lruHead;
+    if (_lruHead != NIL) {
+        _entries[_lruHead].lruPrev = index;
+    } else {
+        _lruTail = index;
+    }
+    _lruHead = index;
+}
+
+void RecordCache::lruUnlink (
+    uint32_t index)
+{
+    entry_t& entry = _entries[index];
+    if (entry.lruPrev != NIL) {
+        _entries[entry.lruPrev].lruNext = entry.lruNext;
+    } else {
+        _lruHead = entry.lruNext;
+    }
+    if (entry.lruNext != NIL) {
+        _entries[entry.lruNext].lruPrev = entry.lruPrev;
+    } else {
+        _lruTail = entry.lruPrev;
+    }
+}
+
+void RecordCache::eraseSlot (
+    size_t slot)
+{
+    uint32_t index = _slots[slot] - 1;
+    _expiry.cancel (_entries[index].timer);
+    _entries[index].timer = TimerWheel::INVALID_HANDLE;
+    _entries[index].used = false;
+    _names.release (_entries[index].name);
+    _entries[index].name = NameTable::INVALID_ID;
+    if (_entries[index].negative) {
+        _negatives--;
+    } else {
+        _version++;
+    }
+    lruUnlink (index);
+    if (_snapshot != nullptr) {
+        _snapshot->remove (index);
+    }
+    _freeEntries.push_back (index);
+    _size--;
+
+    //NOTE: backward shift deletion, keeps probe sequences without
+    // tombstones
+    size_t mask = _slots.size() - 1;
+    size_t i = slot;
+    size_t j = slot;
+    while (true) {
+        j = (j + 1) & mask;
+        if (_slots[j] == 0) {
+            break;
+        }
+        const entry_t& entry = _entries[_slots[j] - 1];
+        size_t k = home (entry.hash, entry.type, mask);
+        bool movable = (i <= j) ? (k <= i || k > j) : (k <= i && k > j);
+        if (movable) {
+            _slots[i] = _slots[j];
+            i = j;
+        }
+    }
+    _slots[i] = 0;
+}
+
+void RecordCache::eraseEntry (
+    uint32_t index)
+{
+    const entry_t& entry = _entries[index];
+    size_t slot = findSlot (entry.hash, entry.type, [&](const entry_t& candidate) {
+        return &candidate == &entry;
+    });
+    if (slot != NOT_FOUND) {
+        eraseSlot (slot);
+    }
+}
+
+void RecordCache::grow ()
+{
+    std::vector<uint32_t> old;
+    old.swap (_slots);
+    _slots.assign (old.size() * 2, 0);
+
+    size_t mask = _slots.size() - 1;
+    for (auto index: old) {
+        if (index != 0) {
+            const entry_t& entry = _entries[index - 1];
+            size_t i = home (entry.hash, entry.type, mask);
+            while (_slots[i] != 0) {
+                i = (i + 1) & mask;
+            }
+            _slots[i] = index;
+        }
+    }
+}
+
+size_t RecordCache::AddressLength (
+    uint16_t type)
+{
+    return type == DnsPacket::RECORDTYPE_AAAA ? 16 : 4;
+}
+
+uint64_t RecordCache::RefreshPoint (
+    uint64_t received,
+    uint32_t ttl,
+    uint8_t refreshes,
+    uint32_t jitter)
+{
+    if (refreshes >= REFRESH_POINTS) {
+        return 0;
+    }
+    uint64_t lifetime = (uint64_t)ttl * 1000;
+    return received + lifetime * (80 + 5 * refreshes) / 100 + lifetime * jitter / 1000;
+}
+
+std::string RecordCache::AddressToString (
+    const entry_t& entry)
+{
+    char address[INET6_ADDRSTRLEN] = { 0 };
+    if (entry.type == DnsPacket::RECORDTYPE_AAAA) {
+        uv_inet_ntop (AF_INET6, &entry.address.v6, address, sizeof(address));
+    } else {
+        uv_inet_ntop (AF_INET, &entry.address.v4, address, sizeof(address));
+    }
+    return address;
+}
+
+}
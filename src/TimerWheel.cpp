@@ -0,0 +1,204 @@
+#include "TimerWheel.hpp"
+
+namespace MDns {
+
+static inline int lowestBit (
+    uint64_t bits)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll (bits);
+#else
+    int i = 0;
+    while ((bits & 1) == 0) {
+        bits >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+static inline uint64_t rotateRight (
+    uint64_t bits,
+    unsigned shift)
+{
+    return shift == 0 ? bits : (bits >> shift) | (bits << (64 - shift));
+}
+
+TimerWheel::TimerWheel (
+    uint64_t now,
+    uint32_t resolution)
+{
+    _resolution = resolution > 0 ? resolution : 1;
+    _current    = now / _resolution;
+
+    for (int level = 0; level < LEVELS; level++) {
+        for (uint32_t slot = 0; slot < SLOTS; slot++) {
+            _slots[level][slot] = NIL;
+        }
+        _occupied[level] = 0;
+    }
+}
+
+TimerWheel::handle_t TimerWheel::schedule (
+    uint64_t deadline,
+    uint32_t data)
+{
+    uint32_t index;
+    if (_free != NIL) {
+        index = _free;
+        _free = _nodes[index].next;
+    } else {
+        _nodes.emplace_back ();
+        index = _nodes.size() - 1;
+    }
+
+    node_t& node = _nodes[index];
+    //NOTE: rounded up, a timer never fires early
+    node.deadline = (deadline + _resolution - 1) / _resolution;
+    node.data = data;
+    node.used = true;
+    link (index);
+    _size++;
+
+    return index;
+}
+
+void TimerWheel::reschedule (
+    handle_t handle,
+    uint64_t deadline)
+{
+    if (handle >= _nodes.size() || !_nodes[handle].used) {
+        return;
+    }
+    unlink (handle);
+    _nodes[handle].deadline = (deadline + _resolution - 1) / _resolution;
+    link (handle);
+}
+
+void TimerWheel::cancel (
+    handle_t handle)
+{
+    if (handle >= _nodes.size() || !_nodes[handle].used) {
+        return;
+    }
+    release (handle);
+}
+
+int64_t TimerWheel::nextTimeout (
+    uint64_t now) const
+{
+    uint64_t tick = nextTick();
+    if (tick == NO_TICK) {
+        return -1;
+    }
+    uint64_t time = tick * _resolution;
+    return time > now ? (int64_t)(time - now) : 0;
+}
+
+void TimerWheel::link (
+    uint32_t index)
+{
+    node_t& node = _nodes[index];
+
+    //NOTE: deadlines already due fire on the next tick
+    uint64_t place = node.deadline > _current ? node.deadline : _current + 1;
+    uint64_t delta = place - _current;
+
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    //NOTE: beyond the wheel range, parked in the farthest slot and
+    // placed again when it cascades
+    if (delta >= (1ULL << (SLOT_BITS * LEVELS))) {
+        place = _current + (1ULL << (SLOT_BITS * LEVELS)) - 1;
+    }
+
+    uint32_t slot = (place >> (SLOT_BITS * level)) & SLOT_MASK;
+    uint32_t& head = _slots[level][slot];
+
+    node.level = level;
+    node.slot  = slot;
+    node.prev  = NIL;
+    node.next  = head;
+    if (head != NIL) {
+        _nodes[head].prev = index;
+    }
+    head = index;
+    _occupied[level] |= 1ULL << slot;
+}
+
+void TimerWheel::unlink (
+    uint32_t index)
+{
+    node_t& node = _nodes[index];
+
+    if (node.prev != NIL) {
+        _nodes[node.prev].next = node.next;
+    } else {
+        _slots[node.level][node.slot] = node.next;
+    }
+    if (node.next != NIL) {
+        _nodes[node.next].prev = node.prev;
+    }
+    if (_slots[node.level][node.slot] == NIL) {
+        _occupied[node.level] &= ~(1ULL << node.slot);
+    }
+}
+
+void TimerWheel::release (
+    uint32_t index)
+{
+    unlink (index);
+    _nodes[index].used = false;
+    _nodes[index].next = _free;
+    _free = index;
+    _size--;
+}
+
+void TimerWheel::cascade (
+    uint64_t tick)
+{
+    for (int level = LEVELS - 1; level > 0; level--) {
+
+        if ((tick & ((1ULL << (SLOT_BITS * level)) - 1)) != 0) {
+            continue;
+        }
+
+        uint32_t slot = (tick >> (SLOT_BITS * level)) & SLOT_MASK;
+        uint32_t index = _slots[level][slot];
+        _slots[level][slot] = NIL;
+        _occupied[level] &= ~(1ULL << slot);
+
+        while (index != NIL) {
+            uint32_t next = _nodes[index].next;
+            link (index);
+            index = next;
+        }
+    }
+}
+
+uint64_t TimerWheel::nextTick () const
+{
+    //NOTE: level 0 slots fire at their tick, higher level slots
+    // cascade when the levels below them wrap around
+    uint64_t tick = NO_TICK;
+    for (int level = 0; level < LEVELS; level++) {
+
+        if (_occupied[level] == 0) {
+            continue;
+        }
+
+        uint64_t group = _current >> (SLOT_BITS * level);
+        unsigned shift = (group + 1) & SLOT_MASK;
+        uint64_t next  = group + 1 + lowestBit (rotateRight (_occupied[level], shift));
+        next <<= SLOT_BITS * level;
+
+        if (next < tick) {
+            tick = next;
+        }
+    }
+    return tick;
+}
+
+}
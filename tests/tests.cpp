@@ -1,13 +1,25 @@
 #include <cassert>
+#include <cstdio>
 #include <string>
+#include <thread>
 #include <Logger.hpp>
 #include "Client.hpp"
 
 auto LOG = MDns::Logger::Get("tests");
 std::shared_ptr<MDns::Client> mdns1;
 std::shared_ptr<MDns::Client> mdns2;
+std::shared_ptr<MDns::Client> mdns3;
 
 void test_2();
+void test_3();
+void test_4();
+void test_5();
+void test_6();
+void test_7();
+void test_8();
+void test_9();
+void test_10();
+void test_11();
 void test_end();
 
 /**
@@ -38,13 +50,257 @@ auto test_2_mdns1_callback = std::make_shared<MDns::Client::CallbackA> ([](bool
     assert (name == "nonexistant");
     assert (ipAddress.empty());
     std::cout << "[TEST]: 2 OK" << std::endl;
-    test_end();
+    test_3();
 });
 
 void test_2 () {
+    mdns1->setNegativeHoldDown (5000);
     mdns1->queryA ("nonexistant", test_2_mdns1_callback, 500);
 }
 
+/**
+ * Test 3: cached query, answered without going to the network
+ */
+bool test_3_answered = false;
+auto test_3_mdns1_callback = std::make_shared<MDns::Client::CallbackA> ([](bool error, const std::string& name, const std::string& ipAddress) {
+    assert (!error);
+    assert (name == mdns2->getLocalDomain());
+    assert (!ipAddress.empty());
+    test_3_answered = true;
+});
+
+void test_3 () {
+    mdns1->queryA (mdns2->getLocalDomain(), test_3_mdns1_callback, 500);
+    assert (test_3_answered);
+    std::cout << "[TEST]: 3 OK" << std::endl;
+    test_4();
+}
+
+/**
+ * Test 4: cached record expires, announced with a TTL of 1 second
+ */
+auto test_4_mdns1_callback = std::make_shared<MDns::Client::CallbackExpired> ([](const std::string& name, const std::string& ipAddress) {
+    assert (name == mdns2->getLocalDomain());
+    assert (!ipAddress.empty());
+    mdns1->setExpiryCallback (nullptr);
+    std::cout << "[TEST]: 4 OK" << std::endl;
+    test_5();
+});
+
+void test_4 () {
+    mdns1->setExpiryCallback (test_4_mdns1_callback);
+    mdns2->announceA (1);
+}
+
+/**
+ * Test 5: cache snapshot, a new client answers from the records saved
+ * by a previous one
+ */
+const char* test_5_snapshot = "tests_snapshot.cache";
+uv_timer_t test_5_timer;
+
+void test_5_restart (uv_timer_t* handle) {
+  
+    uv_close ((uv_handle_t*) &test_5_timer, nullptr);
+    mdns3.reset();
+    
+    bool answered = false;
+    auto callback = std::make_shared<MDns::Client::CallbackA> ([&](bool error, const std::string& name, const std::string& ipAddress) {
+        assert (!error);
+        assert (!ipAddress.empty());
+        answered = true;
+    });
+    
+    mdns3 = MDns::Client::New (uv_default_loop(), MDns::Client::NET_IFACES_DEFAULT, test_5_snapshot);
+    mdns3->queryA (mdns2->getLocalDomain(), callback, 500);
+    assert (answered);
+    mdns3.reset();
+    remove (test_5_snapshot);
+    
+    std::cout << "[TEST]: 5 OK" << std::endl;
+    test_6();
+}
+
+auto test_5_mdns3_callback = std::make_shared<MDns::Client::CallbackA> ([](bool error, const std::string& name, const std::string& ipAddress) {
+    assert (!error);
+    uv_timer_init (uv_default_loop(), &test_5_timer);
+    uv_timer_start (&test_5_timer, &test_5_restart, 10, 0);
+});
+
+void test_5 () {
+    remove (test_5_snapshot);
+    mdns3 = MDns::Client::New (uv_default_loop(), MDns::Client::NET_IFACES_DEFAULT, test_5_snapshot);
+    mdns3->queryA (mdns2->getLocalDomain(), test_5_mdns3_callback, 500);
+}
+
+/**
+ * Test 6: negative cache, the name that timed out in test 2 fails at once
+ * within the hold-down set there
+ */
+bool test_6_answered = false;
+auto test_6_mdns1_callback = std::make_shared<MDns::Client::CallbackA> ([](bool error, const std::string& name, const std::string& ipAddress) {
+    assert (error);
+    assert (name == "nonexistant");
+    test_6_answered = true;
+});
+
+void test_6 () {
+    mdns1->queryA ("nonexistant", test_6_mdns1_callback, 500);
+    assert (test_6_answered);
+    std::cout << "[TEST]: 6 OK" << std::endl;
+    test_7();
+}
+
+/**
+ * Test 7: cache read from another thread, once the loop published it
+ */
+uv_timer_t test_7_timer;
+
+void test_7_lookup (uv_timer_t* handle) {
+  
+    uv_close ((uv_handle_t*) &test_7_timer, nullptr);
+    
+    bool found = false;
+    std::string ipAddress;
+    std::thread reader ([&]() {
+        found = mdns1->lookupCached (mdns2->getLocalDomain(), MDns::DnsPacket::RECORDTYPE_A, ipAddress);
+    });
+    reader.join();
+    
+    assert (found);
+    assert (!ipAddress.empty());
+    std::cout << "[TEST]: 7 OK" << std::endl;
+    test_8();
+}
+
+void test_7 () {
+    uv_timer_init (uv_default_loop(), &test_7_timer);
+    uv_timer_start (&test_7_timer, &test_7_lookup, 50, 0);
+}
+
+/**
+ * Test 8: concurrent queries for the same name share one query, both
+ * callers get its timeout
+ */
+int test_8_answers = 0;
+auto test_8_mdns1_callback = std::make_shared<MDns::Client::CallbackA> ([](bool error, const std::string& name, const std::string& ipAddress) {
+    assert (error);
+    assert (name == "nonexistant-8");
+    test_8_answers++;
+    if (test_8_answers == 2) {
+        std::cout << "[TEST]: 8 OK" << std::endl;
+        test_9();
+    }
+});
+
+void test_8 () {
+    mdns1->queryA ("nonexistant-8", test_8_mdns1_callback, 200);
+    mdns1->queryA ("nonexistant-8", test_8_mdns1_callback, 300);
+    assert (test_8_answers == 0);
+}
+
+/**
+ * Test 9: dual-stack resolve, answers with either family
+ */
+auto test_9_mdns1_callback = std::make_shared<MDns::Client::CallbackA> ([](bool error, const std::string& name, const std::string& ipAddress) {
+    assert (!error);
+    assert (name == mdns2->getLocalDomain());
+    assert (!ipAddress.empty());
+    std::cout << "[TEST]: 9 OK" << std::endl;
+    test_10();
+});
+
+void test_9 () {
+    mdns1->resolve (mdns2->getLocalDomain(), test_9_mdns1_callback, 500);
+}
+
+/**
+ * Test 10: browse, an announced instance is added and its goodbye
+ * removes it
+ */
+const std::string test_10_type = "_mdnscpp-test._tcp.local";
+const std::string test_10_instance = "Test 10." + test_10_type;
+uv_udp_t test_10_socket;
+
+void test_10_announce (uint32_t ttl) {
+    MDns::DnsPacket::Encoder encoder (0x8400U);
+    encoder.addRecordPTR (MDns::DnsPacket::ENTRYTYPE_ANSWER, test_10_type, ttl, test_10_instance);
+    auto packet = encoder.getPacket();
+    struct sockaddr_in group;
+    uv_ip4_addr ("224.0.0.251", 5353, &group);
+    uv_buf_t buf = uv_buf_init ((char*) packet->data(), packet->size());
+    assert (uv_udp_try_send (&test_10_socket, &buf, 1, (const struct sockaddr*) &group) > 0);
+}
+
+auto test_10_mdns1_callback = std::make_shared<MDns::Client::CallbackBrowse> ([](bool added, const std::string& serviceType, const std::string& instance) {
+    assert (serviceType == test_10_type);
+    assert (instance == test_10_instance);
+    if (added) {
+        test_10_announce (0);
+        return;
+    }
+    mdns1->stopBrowse (test_10_type);
+    uv_close ((uv_handle_t*) &test_10_socket, nullptr);
+    std::cout << "[TEST]: 10 OK" << std::endl;
+    test_11();
+});
+
+void test_10 () {
+    uv_udp_init (uv_default_loop(), &test_10_socket);
+    mdns1->browse (test_10_type, test_10_mdns1_callback);
+    test_10_announce (120);
+}
+
+/**
+ * Test 11: goodbye, a record announced with a TTL of 0 is removed and
+ * reported as expired with its name, even when it held the last
+ * reference to it
+ */
+const std::string test_11_name = "mdnscpp-test-11.local";
+uv_udp_t test_11_socket;
+uv_timer_t test_11_timer;
+
+void test_11_announce (uint32_t ttl) {
+    struct sockaddr_in addr;
+    uv_ip4_addr ("192.0.2.11", 0, &addr);
+    MDns::DnsPacket::Encoder encoder (0x8400U);
+    encoder.addRecordA (MDns::DnsPacket::ENTRYTYPE_ANSWER, test_11_name, ttl, &addr);
+    auto packet = encoder.getPacket();
+    struct sockaddr_in group;
+    uv_ip4_addr ("224.0.0.251", 5353, &group);
+    uv_buf_t buf = uv_buf_init ((char*) packet->data(), packet->size());
+    assert (uv_udp_try_send (&test_11_socket, &buf, 1, (const struct sockaddr*) &group) > 0);
+}
+
+void test_11_done (uv_timer_t* handle) {
+    uv_close ((uv_handle_t*) &test_11_timer, nullptr);
+    uv_close ((uv_handle_t*) &test_11_socket, nullptr);
+    std::cout << "[TEST]: 11 OK" << std::endl;
+    test_end();
+}
+
+auto test_11_mdns1_expired = std::make_shared<MDns::Client::CallbackExpired> ([](const std::string& name, const std::string& ipAddress) {
+    assert (name == test_11_name);
+    assert (ipAddress == "192.0.2.11");
+    mdns1->setExpiryCallback (nullptr);
+    //NOTE: the client is still handling the goodbye, end on the next
+    // loop iteration
+    uv_timer_init (uv_default_loop(), &test_11_timer);
+    uv_timer_start (&test_11_timer, &test_11_done, 0, 0);
+});
+
+auto test_11_mdns1_callback = std::make_shared<MDns::Client::CallbackA> ([](bool error, const std::string& name, const std::string& ipAddress) {
+    assert (!error);
+    mdns1->setExpiryCallback (test_11_mdns1_expired);
+    test_11_announce (0);
+});
+
+void test_11 () {
+    uv_udp_init (uv_default_loop(), &test_11_socket);
+    mdns1->queryA (test_11_name, test_11_mdns1_callback, 500);
+    test_11_announce (120);
+}
+
 /**
  * Tests END
  */
@@ -12,7 +12,7 @@ class NhLookup {
   
 public:
   
-    NhLookup() {
+    NhLookup (const std::string& snapshotPath) {
       
         Logger::setLogLevel (Logger::ERROR);
   
@@ -25,7 +25,18 @@ public:
             std::cout << "> " << std::flush;
         });
         
-        mdns = MDns::Client::New (uv_default_loop(), ifacefilter);
+        browseCallback = std::make_shared<MDns::Client::CallbackBrowse> ([&](bool added, const std::string& serviceType, const std::string& instance) {
+            printf ("\n>> %s %s %s\n", serviceType.c_str(), added ? "+" : "-", instance.c_str());
+            std::cout << "> " << std::flush;
+        });
+        
+        expiryCallback = std::make_shared<MDns::Client::CallbackExpired> ([&](const std::string& name, const std::string& ipAddress) {
+            printf ("\n>> %s => %s is gone\n", name.c_str(), ipAddress.c_str());
+            std::cout << "> " << std::flush;
+        });
+        
+        mdns = MDns::Client::New (uv_default_loop(), ifacefilter, snapshotPath);
+        mdns->setExpiryCallback (expiryCallback);
         
         std::cout << std::endl;
         std::cout << "Host Multicast DNS UUID: " << mdns->getLocalDomain() << std::endl;
@@ -51,6 +62,8 @@ private:
     
     std::shared_ptr<Client> mdns = nullptr;
     std::shared_ptr<Client::CallbackA> mdnsCallback = nullptr;
+    std::shared_ptr<Client::CallbackExpired> expiryCallback = nullptr;
+    std::shared_ptr<Client::CallbackBrowse> browseCallback = nullptr;
     uv_tty_t              ttyIn;
     std::stringstream     stdinStream;  
     uint32_t              queryTimeoutMsecs = 500;
@@ -90,6 +103,11 @@ private:
         << "    * d: Deannounce: send own A record on all interfaces (TTL=0)" << std::endl
         << "    * a record: query A record" << std::endl
         << "         Example: a " << mdns->getLocalDomain() << std::endl
+        << "    * 6 record: query AAAA record" << std::endl
+        << "    * s record: resolve, dual-Stack (AAAA preferred, then A)" << std::endl
+        << "    * b service: Browse service instances until stopped" << std::endl
+        << "         Example: b _http._tcp.local" << std::endl
+        << "    * e service: End browse" << std::endl
         << "=============================" << std::endl;
       
     }
@@ -100,7 +118,17 @@ private:
     
     void printCachedRecords() {
         
-        auto now = time (NULL);
+        auto now = CacheView::Now();
+        auto records = mdns->getCachedRecords();
+        
+        auto print = [&](uint16_t type) {
+            for (auto& record: records) {
+                if (record.type == type && record.expiration > now) {
+                    std::cout << ">> | "<< record.name <<" | "<< CacheView::AddressToString (record) 
+                              <<" |           "<< (record.expiration - now) / 1000 <<" |" << std::endl;
+                }
+            }
+        };
         
         std::cout 
         << ">> ==============================================================================" << std::endl
@@ -108,24 +136,17 @@ private:
         << ">> ------------------------------------------------------------------------------" << std::endl
         << ">> |  name                                      | address       | TTL (seconds) |" << std::endl
         << ">> ------------------------------------------------------------------------------" << std::endl;
-        for (auto& record: mdns->_recordsA) {
-            auto name    = record.first;
-            auto ttl     = record.second.first;
-            auto address = record.second.second;
-            std::cout << ">> | "<< name <<" | "<< address <<" |           "<< (ttl-now) <<" |" << std::endl;
-        }
+        print (DnsPacket::RECORDTYPE_A);
         std::cout 
         << ">> ------------------------------------------------------------------------------" << std::endl
         << ">> |                                IPv6                                        |" << std::endl
         << ">> ------------------------------------------------------------------------------" << std::endl;
-        for (auto& record: mdns->_recordsAAAA) {
-            auto name    = record.first;
-            auto ttl     = record.second.first;
-            auto address = record.second.second;
-            std::cout << ">> | "<< name <<" | "<< address <<" |           "<< (ttl-now) <<" |" << std::endl;
-        }
+        print (DnsPacket::RECORDTYPE_AAAA);
+        auto stats = mdns->getCacheStats();
         std::cout
-        << ">> ==============================================================================" << std::endl;
+        << ">> ==============================================================================" << std::endl
+        << ">> hits: " << stats.hits << " misses: " << stats.misses 
+        << " evictions: " << stats.evictions << " expirations: " << stats.expirations << std::endl;
     }
     
     void printNetworkInterfaces() {
@@ -202,6 +223,24 @@ private:
                 mdns->queryA (record, mdnsCallback, queryTimeoutMsecs);
             }
             
+        } else if (line.at(0) == '6' || line.at(0) == 's') {
+            if (line.size() <= 2) {
+                std::cout << ">> Wrong sintax for a command" << std::endl;
+            } else if (line.at(0) == '6') {
+                mdns->queryAAAA (line.substr(2), mdnsCallback, queryTimeoutMsecs);
+            } else {
+                mdns->resolve (line.substr(2), mdnsCallback, queryTimeoutMsecs);
+            }
+            
+        } else if (line.at(0) == 'b' || line.at(0) == 'e') {
+            if (line.size() <= 2) {
+                std::cout << ">> Wrong sintax for a command" << std::endl;
+            } else if (line.at(0) == 'b') {
+                mdns->browse (line.substr(2), browseCallback);
+            } else {
+                mdns->stopBrowse (line.substr(2));
+            }
+            
         } else {
             std::cout << ">> Unknown command: enter h for help" << std::endl;
             
@@ -236,7 +275,8 @@ private:
 
 int main (int argc, char* argv[]) {
   
-    auto nhlookup = new MDns::NhLookup ();
+    //NOTE: optional argument, file to keep the cache in across runs
+    auto nhlookup = new MDns::NhLookup (argc > 1 ? argv[1] : "");
     nhlookup->start();
     delete nhlookup;
     return 0;